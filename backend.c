@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "baya.h"
+
+/* SOFT */
+/* the screen turned into rgba pixels in memory, for whatever embeds the vm */
+/* to read, with no window or gpu behind it */
+
+static void *open_soft() { return calloc(1, sizeof(soft_t)); }
+
+static uint8_t no_keys(void *b) {
+  (void)b;
+  return 0;
+}
+
+static bool present_soft(void *b, const uint8_t *screen) {
+  soft_t *s = b;
+  uint8_t *px;
+  Color c;
+
+  for (size_t y = 0; y < SCREEN_HEIGHT; y++)
+    for (size_t x = 0; x < SCREEN_WIDTH; x++) {
+      c = PALETTE[*screen++ & (PALETTE_SIZE - 1)];
+      px = s->rgba[y][x];
+      px[0] = c.r;
+      px[1] = c.g;
+      px[2] = c.b;
+      px[3] = c.a;
+    }
+  s->frames++;
+  return true;
+}
+
+const backend_t SOFT_BACKEND = {
+    .name = "soft",
+    .draws = true,
+    .open = open_soft,
+    .keys = no_keys,
+    .present = present_soft,
+    .close = free,
+};
+
+/* TERM */
+
+static void *open_terminal() { return open_term(STDOUT_FILENO); }
+
+static bool present_terminal(void *b, const uint8_t *screen) {
+  draw_term(b, screen);
+  return true;
+}
+
+static void close_terminal(void *b) { close_term(b); }
+
+const backend_t TERM_BACKEND = {
+    .name = "term",
+    .paced = true,
+    .draws = true,
+    .on_stdout = true,
+    .open = open_terminal,
+    .keys = no_keys,
+    .present = present_terminal,
+    .close = close_terminal,
+};
+
+/* NULL */
+/* nothing is shown, so the vm is told not to draw either */
+
+static void *open_null() {
+  static uint8_t none;
+  return &none;
+}
+
+static bool present_null(void *b, const uint8_t *screen) {
+  (void)b;
+  (void)screen;
+  return true;
+}
+
+static void close_null(void *b) { (void)b; }
+
+const backend_t NULL_BACKEND = {
+    .name = "null",
+    .open = open_null,
+    .keys = no_keys,
+    .present = present_null,
+    .close = close_null,
+};
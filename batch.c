@@ -0,0 +1,612 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "baya.h"
+
+/* BATCH */
+/* lanes run in lockstep: each step takes the live lane with the lowest pc */
+/* and every other lane at that pc, so lanes that took a branch the others */
+/* skipped catch up and run together again as soon as their paths meet */
+
+// -DBAYA_CHECKED checks lanes as exec does, once per group for what the
+// instruction alone decides and once per lane for the stack and divisors
+#ifdef BAYA_CHECKED
+#define CHECKED true
+#else
+#define CHECKED false
+#endif
+
+// lanes are worked on a vector register at a time, as wider vectors would
+// have the compiler compare them one byte at a time
+#ifdef __AVX2__
+#define CHUNK 32
+#else
+#define CHUNK 16
+#endif
+
+typedef uint8_t bytes_t __attribute__((vector_size(CHUNK), may_alias));
+typedef uint16_t words_t __attribute__((vector_size(CHUNK), may_alias));
+typedef int8_t byte_mask_t __attribute__((vector_size(CHUNK)));
+typedef int16_t word_mask_t __attribute__((vector_size(CHUNK)));
+
+#define BYTES(a, c) (*(bytes_t *)&(a)[(c) * CHUNK])
+#define WORDS(a, c) (*(words_t *)&(a)[(c) * CHUNK / 2])
+#define FOR_BYTES(c) for (uint8_t c = 0; c < BATCH_LANES / CHUNK; c++)
+#define FOR_WORDS(c) for (uint8_t c = 0; c < BATCH_LANES * 2 / CHUNK; c++)
+#define BLEND(a, b, m) (((a) & ~(m)) | ((b) & (m)))
+
+#define FOR_LANES(l, bits)                                                     \
+  for (uint32_t m_ = (bits), l; m_ && (l = __builtin_ctz(m_), 1); m_ &= m_ - 1)
+
+/* MASKS */
+/* groups are bit masks, spread out to bytes or words to blend vectors */
+
+static inline uint64_t spread8(uint32_t bits) {
+  // 8 bits to 8 bytes of 0 or 0xff
+  uint64_t t = (bits & 0xff) * 0x0101010101010101ull & 0x8040201008040201ull;
+
+  t = ((t + 0x7f7f7f7f7f7f7f7full) | t) & 0x8080808080808080ull;
+  return (t >> 7) * 0xff;
+}
+
+static inline uint64_t spread4(uint32_t bits) {
+  // 4 bits to 4 words of 0 or 0xffff
+  uint64_t t = (bits & 0xf) * 0x0001000100010001ull & 0x0008000400020001ull;
+
+  t = ((t + 0x7fff7fff7fff7fffull) | t) & 0x8000800080008000ull;
+  return (t >> 15) * 0xffff;
+}
+
+static inline bytes_t byte_mask(uint32_t bits, uint8_t c) {
+  uint64_t m[CHUNK / 8];
+  bytes_t v;
+
+  for (uint8_t i = 0; i < CHUNK / 8; i++)
+    m[i] = spread8(bits >> (c * CHUNK + 8 * i));
+  memcpy(&v, m, CHUNK);
+  return v;
+}
+
+static inline words_t word_mask(uint32_t bits, uint8_t c) {
+  uint64_t m[CHUNK / 8];
+  words_t v;
+
+  for (uint8_t i = 0; i < CHUNK / 8; i++)
+    m[i] = spread4(bits >> (c * CHUNK / 2 + 4 * i));
+  memcpy(&v, m, CHUNK);
+  return v;
+}
+
+static inline uint32_t byte_bits(byte_mask_t m) {
+  // a bit for every byte of a comparison that held
+#if defined(__AVX2__)
+  return (uint32_t)_mm256_movemask_epi8((__m256i)m);
+#elif defined(__SSE2__)
+  return _mm_movemask_epi8((__m128i)m);
+#else
+  uint32_t bits = 0;
+
+  for (uint8_t i = 0; i < CHUNK; i++) bits |= (uint32_t)(m[i] & 1) << i;
+  return bits;
+#endif
+}
+
+static inline uint32_t word_bits(word_mask_t lo, word_mask_t hi) {
+  // the same for two chunks of words, lo first
+#if defined(__AVX2__)
+  __m256i packed = _mm256_packs_epi16((__m256i)lo, (__m256i)hi);
+
+  // packing works within each half, so the quarters need putting in order
+  return (uint32_t)_mm256_movemask_epi8(
+      _mm256_permute4x64_epi64(packed, 0xd8));
+#elif defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_packs_epi16((__m128i)lo, (__m128i)hi));
+#else
+  uint32_t bits = 0;
+
+  for (uint8_t i = 0; i < CHUNK / 2; i++)
+    bits |= (uint32_t)(lo[i] & 1) << i |
+            (uint32_t)(hi[i] & 1) << (i + CHUNK / 2);
+  return bits;
+#endif
+}
+
+static uint32_t lanes_at(const uint16_t *pc, uint16_t at) {
+  uint32_t bits = 0;
+
+  for (uint8_t c = 0; c < BATCH_LANES * 2 / CHUNK; c += 2)
+    bits |= word_bits(WORDS(pc, c) == at, WORDS(pc, c + 1) == at)
+            << (c * CHUNK / 2);
+  return bits;
+}
+
+static uint16_t lowest_pc(const uint16_t *pc, uint32_t live) {
+  // pcs stay far below 0x7fff, so dead lanes read as that and signed
+  // comparisons do
+  word_mask_t low = {0}, v;
+  uint16_t at = 0x7fff;
+
+  low += 0x7fff;
+  FOR_WORDS(c) {
+    v = BLEND(low, (word_mask_t)WORDS(pc, c), (word_mask_t)word_mask(live, c));
+    low = BLEND(low, v, v < low);
+  }
+  for (uint8_t i = 0; i < CHUNK / 2; i++)
+    if (low[i] < at) at = low[i];
+  return at;
+}
+
+static void set_words(uint16_t *a, uint32_t g, uint16_t v) {
+  FOR_WORDS(c)
+  WORDS(a, c) = BLEND(WORDS(a, c), v + (words_t){0}, word_mask(g, c));
+}
+
+/* PAGES */
+/* lanes read the cart's pages until they write to one, which then gets */
+/* copied for them alone; in practice that is the top page, for the stack */
+
+#define IMAGE(b) ((const uint8_t *)(b)->pages)
+
+static uint32_t new_page(batch_t *b) {
+  if (b->spare_n) return b->spare[--b->spare_n];
+  if (b->page_n == b->page_cap) {
+    b->page_cap *= 2;
+    b->pages = realloc(b->pages, b->page_cap * sizeof(*b->pages));
+    b->spare = realloc(b->spare, b->page_cap * sizeof(uint32_t));
+  }
+  return b->page_n++;
+}
+
+static void share_pages(batch_t *b, lane_block_t *k, uint8_t l) {
+  // hands the lane's copies back and points it at the cart again
+  for (uint8_t i = 0; i < BATCH_PAGES; i++) {
+    if (k->page[l][i] >= BATCH_PAGES) b->spare[b->spare_n++] = k->page[l][i];
+    k->page[l][i] = i;
+  }
+}
+
+static inline uint8_t peek(const batch_t *b, const lane_block_t *k, uint8_t l,
+                           uint16_t at) {
+  at &= MEMORY_SIZE - 1;
+  return b->pages[k->page[l][at / BATCH_PAGE]][at % BATCH_PAGE];
+}
+
+static inline uint8_t *own_page(batch_t *b, lane_block_t *k, uint8_t l,
+                                uint8_t i) {
+  // the lane's copy of page i, made now if it has none
+  uint32_t *page = &k->page[l][i];
+
+  if (*page < BATCH_PAGES) {
+    uint32_t copy = new_page(b);
+    memcpy(b->pages[copy], b->pages[*page], BATCH_PAGE);
+    *page = copy;
+  }
+  return b->pages[*page];
+}
+
+static inline void poke(batch_t *b, lane_block_t *k, uint8_t l, uint16_t at,
+                        uint8_t v) {
+  at &= MEMORY_SIZE - 1;
+  own_page(b, k, l, at / BATCH_PAGE)[at % BATCH_PAGE] = v;
+}
+
+/* LANES */
+
+static void init_lane(batch_t *b, lane_block_t *k, uint8_t l) {
+  share_pages(b, k, l);
+  for (uint8_t r = 0; r < REGISTER_N; r++) k->regs[r][l] = 0;
+  k->keys[l] = 0;
+  k->pc[l] = 0;
+  k->sp[l] = MEMORY_SIZE - 1;
+  k->ip[l] = 0;
+  k->rng[l] = RANDOM_SEED;
+  k->fault[l] = 0;
+  memset(k->screen[l], 0, sizeof(k->screen[l]));
+}
+
+batch_t *open_batch(const uint8_t *image, uint16_t size, uint32_t n) {
+  batch_t *b = calloc(1, sizeof(batch_t));
+  lane_block_t *k;
+
+  if (b == NULL) return NULL;
+  b->n = n;
+  b->blocks = (n + BATCH_LANES - 1) / BATCH_LANES;
+  b->size = size;
+  b->page_cap = 2 * BATCH_PAGES;
+  b->page_n = BATCH_PAGES;
+  b->pages = malloc(b->page_cap * sizeof(*b->pages));
+  b->spare = malloc(b->page_cap * sizeof(uint32_t));
+
+  b->block = aligned_alloc(_Alignof(lane_block_t),
+                           sizeof(lane_block_t) * (b->blocks ? b->blocks : 1));
+  if (b->block == NULL || b->pages == NULL || b->spare == NULL) {
+    close_batch(b);
+    return NULL;
+  }
+  memcpy(b->pages, image, MEMORY_SIZE);
+
+  for (uint32_t i = 0; i < b->blocks; i++) {
+    k = &b->block[i];
+    for (uint8_t l = 0; l < BATCH_LANES; l++)
+      for (uint8_t p = 0; p < BATCH_PAGES; p++) k->page[l][p] = p;
+    for (uint8_t l = 0; l < BATCH_LANES; l++) init_lane(b, k, l);
+    k->on = n - i * BATCH_LANES >= BATCH_LANES
+                ? 0xffffffff
+                : (1u << (n - i * BATCH_LANES)) - 1;
+    k->live = 0;
+    k->own_code = 0;
+  }
+  return b;
+}
+
+void close_batch(batch_t *b) {
+  free(b->block);
+  free(b->pages);
+  free(b->spare);
+  free(b);
+}
+
+void seed_lane(batch_t *b, uint32_t lane, uint32_t seed) {
+  b->block[lane / BATCH_LANES].rng[lane % BATCH_LANES] =
+      seed ? seed : RANDOM_SEED;
+}
+
+void set_lane_keys(batch_t *b, uint32_t lane, uint8_t keys) {
+  b->block[lane / BATCH_LANES].keys[lane % BATCH_LANES] = keys;
+}
+
+void get_lane(const batch_t *b, uint32_t lane, vm_t *vm) {
+  // the state of one instance, leaving out, hooks and options alone
+  const lane_block_t *k = &b->block[lane / BATCH_LANES];
+  uint8_t l = lane % BATCH_LANES;
+
+  for (uint8_t i = 0; i < BATCH_PAGES; i++)
+    memcpy(&vm->mem[i * BATCH_PAGE], b->pages[k->page[l][i]], BATCH_PAGE);
+  for (uint8_t r = 0; r < REGISTER_N; r++) vm->regs[r] = k->regs[r][l];
+  vm->pc = k->pc[l];
+  vm->sp = k->sp[l];
+  vm->ip = k->ip[l];
+  vm->rng = k->rng[l];
+  memcpy(vm->screen, k->screen[l], sizeof(vm->screen));
+  vm->keys = k->keys[l];
+  vm->stack_floor = b->size;
+  vm->fault = k->fault[l];
+}
+
+void put_lane(batch_t *b, uint32_t lane, const vm_t *vm) {
+  lane_block_t *k = &b->block[lane / BATCH_LANES];
+  uint8_t l = lane % BATCH_LANES;
+
+  // pages that match the cart's are shared again
+  share_pages(b, k, l);
+  for (uint8_t i = 0; i < BATCH_PAGES; i++)
+    if (memcmp(&vm->mem[i * BATCH_PAGE], b->pages[i], BATCH_PAGE)) {
+      k->page[l][i] = new_page(b);
+      memcpy(b->pages[k->page[l][i]], &vm->mem[i * BATCH_PAGE], BATCH_PAGE);
+    }
+  for (uint8_t r = 0; r < REGISTER_N; r++) k->regs[r][l] = vm->regs[r];
+  k->pc[l] = vm->pc;
+  k->sp[l] = vm->sp;
+  k->ip[l] = vm->ip;
+  k->rng[l] = vm->rng ? vm->rng : RANDOM_SEED;
+  memcpy(k->screen[l], vm->screen, sizeof(vm->screen));
+  k->keys[l] = vm->keys;
+  k->fault[l] = vm->fault;
+  if (memcmp(vm->mem, IMAGE(b), b->size))
+    k->own_code |= 1u << l;
+  else
+    k->own_code &= ~(1u << l);
+}
+
+/* PER LANE */
+/* what touches a lane's own memory, screen or random state */
+
+static void fault_lane(lane_block_t *k, uint8_t l, fault_t f, uint16_t at) {
+  k->fault[l] = f;
+  k->pc[l] = at;
+  k->live &= ~(1u << l);
+}
+
+static bool save_lane(batch_t *b, lane_block_t *k, uint8_t l, uint16_t at) {
+  static const uint8_t ORDER[] = {RX, RY, RZ, RA, RB, RC, RD, RE, RF};
+  uint16_t sp = k->sp[l];
+
+  if (CHECKED && (sp < b->size + 8 || sp >= MEMORY_SIZE)) {
+    fault_lane(k, l, FAULT_STACK_OVERFLOW, at);
+    return false;
+  }
+  // from here on the lane's code may differ from everyone else's
+  if (sp - 8 < b->size) k->own_code |= 1u << l;
+
+  if (sp >= 8 && sp < MEMORY_SIZE && (sp - 8) / BATCH_PAGE == sp / BATCH_PAGE) {
+    // the usual case, all nine bytes on one page
+    uint8_t *m = own_page(b, k, l, sp / BATCH_PAGE) + sp % BATCH_PAGE;
+    for (uint8_t i = 0; i < 9; i++) *m-- = k->regs[ORDER[i] - 1][l];
+    sp -= 9;
+  } else
+    for (uint8_t i = 0; i < 9; i++)
+      poke(b, k, l, sp--, k->regs[ORDER[i] - 1][l]);
+  k->sp[l] = sp;
+  return true;
+}
+
+static bool load_lane(const batch_t *b, lane_block_t *k, uint8_t l,
+                      uint16_t at) {
+  static const uint8_t ORDER[] = {RF, RE, RD, RC, RB, RA, RZ, RY, RX};
+  uint16_t sp = k->sp[l];
+
+  // sp wraps round below a floor of 0, as it does in the vm
+  if (CHECKED && (uint16_t)(sp + 1) > MEMORY_SIZE - 9) {
+    fault_lane(k, l, FAULT_STACK_UNDERFLOW, at);
+    return false;
+  }
+  if (sp + 9 < MEMORY_SIZE && (sp + 1) / BATCH_PAGE == (sp + 9) / BATCH_PAGE) {
+    const uint8_t *m = b->pages[k->page[l][(sp + 1) / BATCH_PAGE]] +
+                       (sp + 1) % BATCH_PAGE;
+    for (uint8_t i = 0; i < 9; i++) k->regs[ORDER[i] - 1][l] = *m++;
+    sp += 9;
+  } else
+    for (uint8_t i = 0; i < 9; i++)
+      k->regs[ORDER[i] - 1][l] = peek(b, k, l, ++sp);
+  k->sp[l] = sp;
+  return true;
+}
+
+static void draw_lane(const batch_t *b, lane_block_t *k, uint8_t l,
+                      const uint8_t *p) {
+  uint8_t spr[4];
+  uint8_t ox = k->regs[p[1] - 1][l];
+  uint8_t oy = k->regs[p[2] - 1][l];
+  uint8_t col = p[3] & (PALETTE_SIZE - 1);
+
+  for (uint8_t y = 0; y < 4; y++) spr[y] = peek(b, k, l, k->ip[l] + y);
+  for (size_t y = 0; y < 4 && oy + y < SCREEN_HEIGHT; y++)
+    for (size_t x = 0; x < 8 && ox + x < SCREEN_WIDTH; x++)
+      if (spr[y] & (128 >> x)) k->screen[l][oy + y][ox + x] = col;
+}
+
+/* GROUPS */
+
+// x = expr of x and y, a chunk at a time, in the lanes of g
+#define OP_LANES(expr)                                                         \
+  FOR_BYTES(c) {                                                               \
+    bytes_t x = BYTES(rx, c), y = BYTES(ry, c);                                \
+    BYTES(rx, c) = BLEND(x, (expr), byte_mask(g, c));                          \
+  }
+
+// the lanes where expr of x and y holds get skipped over
+#define SKIP_LANES(a, b, expr)                                                 \
+  FOR_BYTES(c) {                                                               \
+    bytes_t x = BYTES(a, c), y = BYTES(b, c);                                  \
+    (void)y;                                                                   \
+    skip |= byte_bits(expr) << (c * CHUNK);                                    \
+  }
+
+static void op_lanes(lane_block_t *k, const uint8_t *p, uint32_t g,
+                     uint16_t at) {
+  uint8_t *rx = k->regs[p[2] - 1];
+  uint8_t *ry = k->regs[p[3] - 1];
+
+  switch (p[1]) {
+  case SET:
+    OP_LANES(y);
+    break;
+  case ADD:
+    OP_LANES(x + y);
+    break;
+  case SUB:
+    OP_LANES(x - y);
+    break;
+  case MUL:
+    OP_LANES(x * y);
+    break;
+  case DIV:
+  case MOD:
+    // no vector divide for bytes, and each divisor needs checking anyway
+    FOR_LANES(l, g) {
+      if (CHECKED && ry[l] == 0)
+        fault_lane(k, l, FAULT_DIVIDE, at);
+      else
+        rx[l] = p[1] == DIV ? rx[l] / ry[l] : rx[l] % ry[l];
+    }
+    break;
+  case AND:
+    OP_LANES(x & y);
+    break;
+  case OR:
+    OP_LANES(x | y);
+    break;
+  case XOR:
+    OP_LANES(x ^ y);
+    break;
+  }
+}
+
+// the register the instruction names first
+#define R k->regs[p[1] - 1]
+
+static int run_group(batch_t *b, lane_block_t *k, uint16_t at, uint32_t g,
+                     const uint8_t *p) {
+  // runs the instruction p at at on every lane in g as exec would, and
+  // returns where they all went next, or -1 if they went different ways;
+  // only then are their pcs written, the caller keeps them otherwise
+  uint16_t next = at + 4;
+  uint16_t nnn = p[1] * 0x100 + p[2] * 0x10 + p[3];
+  uint8_t nn = p[2] * 0x10 + p[3];
+  uint32_t skip = 0;
+  uint32_t id;
+  fault_t f;
+
+  b->issued++;
+  b->lanes += __builtin_popcount(g);
+
+  if (CHECKED &&
+      (f = at > MEMORY_SIZE - 4 ? FAULT_PC : check_code(p, false))) {
+    FOR_LANES(l, g) fault_lane(k, l, f, at);
+    return -1;
+  }
+
+  switch (p[0]) {
+  case 0:
+  case HALT:
+    k->live &= ~g;
+    return -1;
+  case SAVE:
+    FOR_LANES(l, g) if (!save_lane(b, k, l, at)) g &= ~(1u << l);
+    break;
+  case LOAD:
+    FOR_LANES(l, g) if (!load_lane(b, k, l, at)) g &= ~(1u << l);
+    break;
+  case GOTO:
+    next = nnn;
+    break;
+  case POINT:
+    set_words(k->ip, g, nnn);
+    break;
+  case PRINT:
+    if (b->print) {
+      id = b->print->id + (k - b->block) * BATCH_LANES;
+      FOR_LANES(l, g) push_print(b->print, id + l, p[1], R[l]);
+    } else if (b->out)
+      FOR_LANES(l, g) fprintf(b->out, "%d\n", R[l]);
+    break;
+  case CLEAR:
+    FOR_LANES(l, g)
+    memset(k->screen[l], p[1] & (PALETTE_SIZE - 1), sizeof(k->screen[l]));
+    break;
+  case SPRITE:
+    FOR_LANES(l, g) draw_lane(b, k, l, p);
+    break;
+  case REG_OP_REG:
+    // exec stops reading a bad operator before its second register
+    if (p[1] < SET || p[1] > XOR) next = at + 3;
+    op_lanes(k, p, g, at);
+    g &= k->live;
+    break;
+  case REG_SET_LIT:
+    FOR_BYTES(c) BYTES(R, c) = BLEND(BYTES(R, c), nn + (bytes_t){0},
+                                      byte_mask(g, c));
+    break;
+  case REG_ADD_LIT:
+    FOR_BYTES(c) BYTES(R, c) += byte_mask(g, c) & nn;
+    break;
+  case REG_RANDOM:
+    FOR_LANES(l, g) R[l] = random_below(&k->rng[l], nn);
+    break;
+  case IF_REG_CMP_REG: {
+    uint8_t *rx = k->regs[p[2] - 1], *ry = k->regs[p[3] - 1];
+
+    switch (p[1]) {
+    case EQ:
+      SKIP_LANES(rx, ry, x != y);
+      break;
+    case NE:
+      SKIP_LANES(rx, ry, x == y);
+      break;
+    case LT:
+      SKIP_LANES(rx, ry, x >= y);
+      break;
+    case LE:
+      SKIP_LANES(rx, ry, x > y);
+      break;
+    case GT:
+      SKIP_LANES(rx, ry, x <= y);
+      break;
+    case GE:
+      SKIP_LANES(rx, ry, x < y);
+      break;
+    }
+    break;
+  }
+  case IF_REG_EQ_LIT:
+    SKIP_LANES(R, R, x != nn);
+    break;
+  case IF_REG_NE_LIT:
+    SKIP_LANES(R, R, x == nn);
+    break;
+  case IF_KEY:
+    if (p[1] >= KACTION && p[1] <= KRIGHT)
+      SKIP_LANES(k->keys, k->keys, (x & (uint8_t)(1 << (p[1] - 1))) == 0);
+    break;
+  default:
+    // unknown opcodes and traps with no debugger to stop for are one byte
+    next = at + 1;
+    break;
+  }
+
+  skip &= g;
+  if (skip == 0) return next;
+  if (skip == g) return next + 4;
+
+  // the group split, so each lane's pc goes its own way
+  FOR_WORDS(c) {
+    words_t to = next + (words_t){0} + (word_mask(skip, c) & 4);
+    WORDS(k->pc, c) = BLEND(WORDS(k->pc, c), to, word_mask(g, c));
+  }
+  return -1;
+}
+
+#undef R
+
+static void run_block(batch_t *b, lane_block_t *k) {
+  uint32_t g = 0;
+  uint16_t at;
+  uint8_t leader, p[4];
+  bool whole = false;
+  int next = -1;
+
+  while (k->live) {
+    if (next >= 0 && whole && !(k->live & k->own_code) &&
+        next + 4 <= b->size) {
+      // the whole block moved on together, so it is still one group
+      at = next;
+      g = k->live;
+      leader = __builtin_ctz(g);
+    } else {
+      if (next >= 0) set_words(k->pc, g & k->live, next);
+      at = lowest_pc(k->pc, k->live);
+      g = lanes_at(k->pc, at) & k->live;
+      leader = __builtin_ctz(g);
+
+      // every lane's code is the cart's, until one saves over it
+      if (k->own_code & 1u << leader || at + 4 > b->size)
+        g = 1u << leader;
+      else
+        g &= ~k->own_code;
+    }
+    whole = g == k->live;
+
+    // a group of more than one lane is only ever running the cart's code
+    if (g == 1u << leader)
+      for (uint8_t i = 0; i < 4; i++) p[i] = peek(b, k, leader, at + i);
+    else
+      memcpy(p, IMAGE(b) + at, 4);
+    next = run_group(b, k, at, g, p);
+  }
+}
+
+void run_batch_frame(batch_t *b) {
+  lane_block_t *k;
+  uint32_t ok;
+
+  for (uint32_t i = 0; i < b->blocks; i++) {
+    k = &b->block[i];
+    ok = k->on;
+    for (uint8_t l = 0; l < BATCH_LANES; l++)
+      if (k->fault[l]) ok &= ~(1u << l);
+
+    k->live = ok;
+    run_block(b, k);
+
+    // a faulted lane keeps its pc and stays stopped, as in run_frame
+    FOR_LANES(l, ok) if (k->fault[l]) ok &= ~(1u << l);
+    set_words(k->pc, ok, 0);
+    // the mask is -1 in every lane to tick
+    FOR_BYTES(c) BYTES(k->regs[RT - 1], c) -= byte_mask(ok, c);
+  }
+  if (b->print) b->print->t++;
+}
@@ -1,20 +1,11 @@
 #include <ctype.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <stdio.h>
+#include <setjmp.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <time.h>
 
-#include "raylib.h"
-
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
-#define TOKEN_LENGTH 32
-#define LABEL_MAX 64
-
-#define PALETTE_SIZE 8
+#include "baya.h"
 
 const Color COLOR_BG = {20, 20, 40, 255};
 const Color COLOR_MG = {100, 100, 140, 255};
@@ -28,212 +19,216 @@ const Color COLOR_WAVE = {50, 150, 200, 255};
 Color PALETTE[] = {COLOR_BG,   COLOR_MG,   COLOR_FG,   COLOR_ROSE,
                    COLOR_WOOD, COLOR_SAND, COLOR_VINE, COLOR_WAVE};
 
-uint8_t scale = 6;
+// everything one assembly works on, so any number can run at once
+typedef struct {
+  const char *src; // the source being assembled
+  size_t src_len;
+  size_t src_at;
+  jmp_buf error_jump;
+
+  char token[TOKEN_LENGTH];
+  uint16_t line;
+  uint16_t column;
+  uint16_t token_line; // where the last token started
+  uint16_t token_column;
+
+  diag_t diag[DIAG_MAX];
+  uint8_t diag_n;
+
+  char label[LABEL_MAX][TOKEN_LENGTH];
+  uint8_t label_n;
+  uint16_t label_offset[LABEL_MAX];
+  bool label_defined[LABEL_MAX];
+  uint16_t label_line[LABEL_MAX]; // where it first appeared
+  uint16_t label_column[LABEL_MAX];
+
+  uint16_t line_at[MEMORY_SIZE];
 
-FILE *file;
-char token[TOKEN_LENGTH];
-uint8_t line = 1;
+  // where goto and point left a label index to be replaced by its offset
+  uint16_t fixup[MEMORY_SIZE / 4];
+  uint16_t fixup_n;
 
+  uint8_t mem[MEMORY_SIZE];
+  uint16_t pc;
+
+  char alias[REGISTER_N][TOKEN_LENGTH];
+} asm_t;
+
+// the last cart assemble left, for the frontend's tools
+diag_t diag[DIAG_MAX];
+uint8_t diag_n;
 char label[LABEL_MAX][TOKEN_LENGTH];
 uint8_t label_n = 0;
 uint16_t label_offset[LABEL_MAX];
-
-uint8_t mem[(1 << 12)];
+bool label_defined[LABEL_MAX];
+uint16_t line_at[MEMORY_SIZE];
+uint8_t mem[MEMORY_SIZE];
 uint16_t pc = 0;
-uint16_t sp = (1 << 12) - 1;
-uint16_t ip = 0; // index pointer
-
-#define REGISTER_N 12
-uint8_t regs[REGISTER_N];
-
 char alias[REGISTER_N][TOKEN_LENGTH];
 
-/* ENUMS */
-/* starting at 1, because 0 represents an invalid token */
-
-typedef enum { RX = 1, RY, RZ, RW, RA, RB, RC, RD, RE, RF, RT } reg_t;
-
-typedef enum { KACTION = 1, KUP, KDOWN, KLEFT, KRIGHT } keys_t;
-
-typedef enum {
-  HALT = 1,
-  SAVE,           // save
-  LOAD,           // load
-  GOTO,           // goto NNN
-  PRINT,          // print x
-  CLEAR,          // clear N
-  POINT,          // point NNN
-  SPRITE,         // sprite x y col
-  REG_OP_REG,     // x o= y
-  REG_SET_LIT,    // x = NN
-  REG_ADD_LIT,    // x += NN
-  REG_RANDOM,     // x = random NN
-  IF_REG_CMP_REG, // if x c y then
-  IF_REG_EQ_LIT,  // if x == NN then
-  IF_REG_NE_LIT,  // if x != NN then
-  IF_KEY,         // key K then
-} ins_t;
-
-typedef enum {
-  SET = 1, // =
-  ADD,     // +=
-  SUB,     // -=
-  MUL,     // *=
-  DIV,     // /=
-  MOD,     // %=
-  AND,     // &=
-  OR,      // |=
-  XOR,     // ^=
-} op_t;
-
-typedef enum {
-  EQ = 1, // ==
-  NE,     // !=
-  LT,     // <
-  LE,     // <=
-  GT,     // >
-  GE,     // >=
-} cmp_t;
+const char *INS_NAME[] = {
+    "?",          "HALT",           "SAVE",          "LOAD",
+    "GOTO",       "PRINT",          "CLEAR",         "POINT",
+    "SPRITE",     "REG_OP_REG",     "REG_SET_LIT",   "REG_ADD_LIT",
+    "REG_RANDOM", "IF_REG_CMP_REG", "IF_REG_EQ_LIT", "IF_REG_NE_LIT",
+    "IF_KEY",     "TRAP",
+};
 
 /* ENCODERS */
 
-void encode_write(uint8_t n) {
-  mem[pc++] = n;
+void encode_write(asm_t *as, uint8_t n) {
+  as->mem[as->pc++] = n;
   return;
 }
 
-void encode_halt() {
-  mem[pc++] = HALT;
-  pc += 3;
+void encode_halt(asm_t *as) {
+  as->mem[as->pc++] = HALT;
+  as->pc += 3;
 }
 
-void encode_save() {
-  mem[pc++] = SAVE;
-  pc += 3;
+void encode_save(asm_t *as) {
+  as->mem[as->pc++] = SAVE;
+  as->pc += 3;
 }
 
-void encode_load() {
-  mem[pc++] = LOAD;
-  pc += 3;
+void encode_load(asm_t *as) {
+  as->mem[as->pc++] = LOAD;
+  as->pc += 3;
 }
 
-void encode_goto(uint16_t n) {
-  mem[pc++] = GOTO;
-  mem[pc++] = (n & 0xf00) >> 8;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_goto(asm_t *as, uint16_t n) {
+  as->fixup[as->fixup_n++] = as->pc;
+  as->mem[as->pc++] = GOTO;
+  as->mem[as->pc++] = (n & 0xf00) >> 8;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_point(uint16_t n) {
-  mem[pc++] = POINT;
-  mem[pc++] = (n & 0xf00) >> 8;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_point(asm_t *as, uint16_t n) {
+  as->fixup[as->fixup_n++] = as->pc;
+  as->mem[as->pc++] = POINT;
+  as->mem[as->pc++] = (n & 0xf00) >> 8;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_print(reg_t r) {
-  mem[pc++] = PRINT;
-  mem[pc++] = r;
-  pc += 2;
+void encode_print(asm_t *as, reg_t r) {
+  as->mem[as->pc++] = PRINT;
+  as->mem[as->pc++] = r;
+  as->pc += 2;
 }
 
-void encode_clear(uint8_t n) {
-  mem[pc++] = CLEAR;
-  mem[pc++] = n & (PALETTE_SIZE - 1);
-  pc += 2;
+void encode_clear(asm_t *as, uint8_t n) {
+  as->mem[as->pc++] = CLEAR;
+  as->mem[as->pc++] = n & (PALETTE_SIZE - 1);
+  as->pc += 2;
 }
 
-void encode_sprite(reg_t x, reg_t y, uint8_t col) {
-  mem[pc++] = SPRITE;
-  mem[pc++] = x;
-  mem[pc++] = y;
-  mem[pc++] = col & (PALETTE_SIZE - 1);
+void encode_sprite(asm_t *as, reg_t x, reg_t y, uint8_t col) {
+  as->mem[as->pc++] = SPRITE;
+  as->mem[as->pc++] = x;
+  as->mem[as->pc++] = y;
+  as->mem[as->pc++] = col & (PALETTE_SIZE - 1);
 }
 
-void encode_reg_op_reg(op_t op, reg_t x, reg_t y) {
-  mem[pc++] = REG_OP_REG;
-  mem[pc++] = op;
-  mem[pc++] = x;
-  mem[pc++] = y;
+void encode_reg_op_reg(asm_t *as, op_t op, reg_t x, reg_t y) {
+  as->mem[as->pc++] = REG_OP_REG;
+  as->mem[as->pc++] = op;
+  as->mem[as->pc++] = x;
+  as->mem[as->pc++] = y;
 }
 
-void encode_reg_set_lit(reg_t r, uint8_t n) {
-  mem[pc++] = REG_SET_LIT;
-  mem[pc++] = r;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_reg_set_lit(asm_t *as, reg_t r, uint8_t n) {
+  as->mem[as->pc++] = REG_SET_LIT;
+  as->mem[as->pc++] = r;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_reg_add_lit(reg_t r, uint8_t n) {
-  mem[pc++] = REG_ADD_LIT;
-  mem[pc++] = r;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_reg_add_lit(asm_t *as, reg_t r, uint8_t n) {
+  as->mem[as->pc++] = REG_ADD_LIT;
+  as->mem[as->pc++] = r;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_reg_random(reg_t r, uint8_t n) {
-  mem[pc++] = REG_RANDOM;
-  mem[pc++] = r;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_reg_random(asm_t *as, reg_t r, uint8_t n) {
+  as->mem[as->pc++] = REG_RANDOM;
+  as->mem[as->pc++] = r;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_if_reg_cmp_reg(cmp_t cmp, reg_t x, reg_t y) {
-  mem[pc++] = IF_REG_CMP_REG;
-  mem[pc++] = cmp;
-  mem[pc++] = x;
-  mem[pc++] = y;
+void encode_if_reg_cmp_reg(asm_t *as, cmp_t cmp, reg_t x, reg_t y) {
+  as->mem[as->pc++] = IF_REG_CMP_REG;
+  as->mem[as->pc++] = cmp;
+  as->mem[as->pc++] = x;
+  as->mem[as->pc++] = y;
 }
 
-void encode_if_reg_eq_lit(reg_t r, uint8_t n) {
-  mem[pc++] = IF_REG_EQ_LIT;
-  mem[pc++] = r;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_if_reg_eq_lit(asm_t *as, reg_t r, uint8_t n) {
+  as->mem[as->pc++] = IF_REG_EQ_LIT;
+  as->mem[as->pc++] = r;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_if_reg_ne_lit(reg_t r, uint8_t n) {
-  mem[pc++] = IF_REG_NE_LIT;
-  mem[pc++] = r;
-  mem[pc++] = (n & 0xf0) >> 4;
-  mem[pc++] = (n & 0xf);
+void encode_if_reg_ne_lit(asm_t *as, reg_t r, uint8_t n) {
+  as->mem[as->pc++] = IF_REG_NE_LIT;
+  as->mem[as->pc++] = r;
+  as->mem[as->pc++] = (n & 0xf0) >> 4;
+  as->mem[as->pc++] = (n & 0xf);
 }
 
-void encode_if_key(keys_t key) {
-  mem[pc++] = IF_KEY;
-  mem[pc++] = key;
-  pc += 2;
+void encode_if_key(asm_t *as, keys_t key) {
+  as->mem[as->pc++] = IF_KEY;
+  as->mem[as->pc++] = key;
+  as->pc += 2;
 }
 
 /* ERROR AND CHECKS */
 
-void error(const char *msg) {
-  printf("ERROR AROUND LINE %d: %s\n", line, msg);
-  exit(1);
+void add_diag(asm_t *as, diag_level_t level, uint16_t at_line,
+              uint16_t at_column, const char *at_token, const char *msg) {
+  // an error ends assembly, so it takes the last slot if there is no other
+  if (as->diag_n == DIAG_MAX) {
+    if (level != DIAG_ERROR) return;
+    as->diag_n--;
+  }
+  as->diag[as->diag_n] = (diag_t){level, at_line, at_column, msg, ""};
+  strcpy(as->diag[as->diag_n].token, at_token);
+  as->diag_n++;
+}
+
+void error(asm_t *as, const char *msg) {
+  // back out of the statement being parsed to assemble
+  add_diag(as, DIAG_ERROR, as->token_line, as->token_column, as->token, msg);
+  longjmp(as->error_jump, 1);
 }
 
-bool is_number(uint8_t *n) {
+bool is_number(asm_t *as, uint8_t *n) {
   int i = 0;
   int ch = 0;
   int dig = 0;
   int num = 0;
-  int len = strlen(token);
+  int len = strlen(as->token);
   int base = 10;
   bool neg = false;
 
-  if (token[0] == '0' && token[1] == 'b') {
+  if (as->token[0] == '0' && as->token[1] == 'b') {
     i = 2;
     base = 2;
-  } else if (token[0] == '0' && token[1] == 'x') {
+  } else if (as->token[0] == '0' && as->token[1] == 'x') {
     i = 2;
     base = 16;
-  } else if (token[0] == '-') {
+  } else if (as->token[0] == '-') {
     i = 1;
     neg = true;
   }
+  if (i == len) return false;
 
   for (; i < len; i++) {
-    ch = token[i];
+    ch = as->token[i];
     if (ch == '_') continue;
 
     if (48 <= ch && ch <= 57)
@@ -245,615 +240,1255 @@ bool is_number(uint8_t *n) {
     } else {
       return false;
     }
-    num = num * base + dig;
+    // a digit of another base, or more than a byte holds
+    if (dig >= base) return false;
+    if ((num = num * base + dig) > 0xff) return false;
   }
 
   *n = num * (neg ? -1 : 1);
   return true;
 }
 
-reg_t is_register() {
-  if (strcmp(token, "x") == 0) return RX;
-  if (strcmp(token, "y") == 0) return RY;
-  if (strcmp(token, "z") == 0) return RZ;
-  if (strcmp(token, "w") == 0) return RW;
-  if (strcmp(token, "a") == 0) return RA;
-  if (strcmp(token, "b") == 0) return RB;
-  if (strcmp(token, "c") == 0) return RC;
-  if (strcmp(token, "d") == 0) return RD;
-  if (strcmp(token, "e") == 0) return RE;
-  if (strcmp(token, "f") == 0) return RF;
-  if (strcmp(token, "t") == 0) return RT;
+reg_t is_register(asm_t *as) {
+  if (strcmp(as->token, "x") == 0) return RX;
+  if (strcmp(as->token, "y") == 0) return RY;
+  if (strcmp(as->token, "z") == 0) return RZ;
+  if (strcmp(as->token, "w") == 0) return RW;
+  if (strcmp(as->token, "a") == 0) return RA;
+  if (strcmp(as->token, "b") == 0) return RB;
+  if (strcmp(as->token, "c") == 0) return RC;
+  if (strcmp(as->token, "d") == 0) return RD;
+  if (strcmp(as->token, "e") == 0) return RE;
+  if (strcmp(as->token, "f") == 0) return RF;
+  if (strcmp(as->token, "t") == 0) return RT;
   return 0;
 }
 
-reg_t is_register_or_alias() {
+reg_t is_register_or_alias(asm_t *as) {
   reg_t reg;
 
-  if ((reg = is_register())) return reg;
+  if ((reg = is_register(as))) return reg;
 
   for (uint8_t i = 0; i < REGISTER_N; i++)
-    if (strcmp(token, alias[i]) == 0) return i + 1;
+    if (strcmp(as->token, as->alias[i]) == 0) return i + 1;
 
   return 0;
 }
 
-keys_t is_key() {
-  if (strcmp(token, "action") == 0) return KACTION;
-  if (strcmp(token, "up") == 0) return KUP;
-  if (strcmp(token, "down") == 0) return KDOWN;
-  if (strcmp(token, "left") == 0) return KLEFT;
-  if (strcmp(token, "right") == 0) return KRIGHT;
+keys_t is_key(asm_t *as) {
+  if (strcmp(as->token, "action") == 0) return KACTION;
+  if (strcmp(as->token, "up") == 0) return KUP;
+  if (strcmp(as->token, "down") == 0) return KDOWN;
+  if (strcmp(as->token, "left") == 0) return KLEFT;
+  if (strcmp(as->token, "right") == 0) return KRIGHT;
   return 0;
 }
 
-op_t is_operator() {
-  if (strcmp(token, "=") == 0) return SET;
-  if (strcmp(token, "+=") == 0) return ADD;
-  if (strcmp(token, "-=") == 0) return SUB;
-  if (strcmp(token, "*=") == 0) return MUL;
-  if (strcmp(token, "/=") == 0) return DIV;
-  if (strcmp(token, "%=") == 0) return MOD;
-  if (strcmp(token, "&=") == 0) return AND;
-  if (strcmp(token, "|=") == 0) return OR;
-  if (strcmp(token, "^=") == 0) return XOR;
+op_t is_operator(asm_t *as) {
+  if (strcmp(as->token, "=") == 0) return SET;
+  if (strcmp(as->token, "+=") == 0) return ADD;
+  if (strcmp(as->token, "-=") == 0) return SUB;
+  if (strcmp(as->token, "*=") == 0) return MUL;
+  if (strcmp(as->token, "/=") == 0) return DIV;
+  if (strcmp(as->token, "%=") == 0) return MOD;
+  if (strcmp(as->token, "&=") == 0) return AND;
+  if (strcmp(as->token, "|=") == 0) return OR;
+  if (strcmp(as->token, "^=") == 0) return XOR;
   return 0;
 }
 
-cmp_t is_compare() {
-  if (strcmp(token, "==") == 0) return EQ;
-  if (strcmp(token, "!=") == 0) return NE;
-  if (strcmp(token, "<") == 0) return LT;
-  if (strcmp(token, "<=") == 0) return LE;
-  if (strcmp(token, ">") == 0) return GT;
-  if (strcmp(token, ">=") == 0) return GE;
+cmp_t is_compare(asm_t *as) {
+  if (strcmp(as->token, "==") == 0) return EQ;
+  if (strcmp(as->token, "!=") == 0) return NE;
+  if (strcmp(as->token, "<") == 0) return LT;
+  if (strcmp(as->token, "<=") == 0) return LE;
+  if (strcmp(as->token, ">") == 0) return GT;
+  if (strcmp(as->token, ">=") == 0) return GE;
   return 0;
 }
 
 /* FILE PARSER */
 
-char *scan_token() {
-  char c;
+char *scan_token(asm_t *as) {
+  int c;
   uint8_t i = 0;
   bool comment = false;
 
-  while ((c = fgetc(file)) != EOF) {
-    if (c == '\n') line++;
+  while (as->src_at < as->src_len) {
+    c = (uint8_t)as->src[as->src_at++];
+    if (c == '\n') {
+      as->line++;
+      as->column = 0;
+    } else
+      as->column++;
 
     comment = comment && c != ')' || c == '(';
     if (comment || c == ')') continue;
 
     if (isgraph(c) && i < (TOKEN_LENGTH - 1)) {
-      token[i++] = c;
+      if (i == 0) {
+        as->token_line = as->line;
+        as->token_column = as->column;
+      }
+      as->token[i++] = c;
       continue;
     }
 
     if (i == 0) continue;
-    token[i] = '\0';
-    return token;
+    as->token[i] = '\0';
+    return as->token;
   }
-  return NULL;
+
+  // the source may end right after its last token
+  if (i == 0) return NULL;
+  as->token[i] = '\0';
+  return as->token;
 }
 
-void next_token() {
-  if (scan_token() != NULL) return;
-  error("missing token");
+void next_token(asm_t *as) {
+  if (scan_token(as) != NULL) return;
+  as->token_line = as->line;
+  as->token_column = as->column + 1;
+  as->token[0] = '\0';
+  error(as, "missing token");
 }
 
 /* STATEMENTS PARSER */
 
-void parse_alias() {
+void parse_alias(asm_t *as) {
   reg_t reg;
 
-  next_token();
-  if (!(reg = is_register())) error("expected register in alias");
+  next_token(as);
+  if (!(reg = is_register(as))) error(as, "expected register in alias");
 
-  next_token();
-  strcpy(alias[reg - 1], token);
+  next_token(as);
+  strcpy(as->alias[reg - 1], as->token);
 }
 
-void parse_write() {
+void parse_write(asm_t *as) {
   uint8_t num;
 
-  next_token();
-  if (!is_number(&num)) error("invalid number");
+  next_token(as);
+  if (!is_number(as, &num)) error(as, "invalid number");
 
-  encode_write(num);
+  encode_write(as, num);
 }
 
-void parse_assign() {
+void parse_assign(asm_t *as) {
   reg_t reg_to;
   reg_t reg_from;
   op_t op;
   uint8_t num;
 
-  reg_to = is_register_or_alias();
-  next_token();
-  if (!(op = is_operator())) error("expected operator after register");
+  reg_to = is_register_or_alias(as);
+  next_token(as);
+  if (!(op = is_operator(as))) error(as, "expected operator after register");
 
-  next_token();
-  if ((reg_from = is_register_or_alias())) {
-    encode_reg_op_reg(op, reg_to, reg_from);
+  next_token(as);
+  if ((reg_from = is_register_or_alias(as))) {
+    encode_reg_op_reg(as, op, reg_to, reg_from);
     return;
   }
 
-  if (op == SET && strcmp(token, "random") == 0) {
-    next_token();
-    if (!is_number(&num)) error("invalid number");
+  if (op == SET && strcmp(as->token, "random") == 0) {
+    next_token(as);
+    if (!is_number(as, &num)) error(as, "invalid number");
 
-    encode_reg_random(reg_to, num);
+    encode_reg_random(as, reg_to, num);
     return;
   }
 
-  if (!(op == SET || op == ADD)) error("unexpected assignment operation");
-  if (!is_number(&num)) error("invalid number");
+  if (!(op == SET || op == ADD)) error(as, "unexpected assignment operation");
+  if (!is_number(as, &num)) error(as, "invalid number");
 
   if (op == SET)
-    encode_reg_set_lit(reg_to, num);
+    encode_reg_set_lit(as, reg_to, num);
   else
-    encode_reg_add_lit(reg_to, num);
+    encode_reg_add_lit(as, reg_to, num);
 }
 
-void parse_if() {
+void parse_if(asm_t *as) {
   reg_t reg_lhs;
   reg_t reg_rhs;
   cmp_t cmp;
   uint8_t num;
 
-  next_token();
-  if (!(reg_lhs = is_register_or_alias()))
-    error("expected register in condition");
+  next_token(as);
+  if (!(reg_lhs = is_register_or_alias(as)))
+    error(as, "expected register in condition");
 
-  next_token();
-  if (!(cmp = is_compare())) error("expected comparison");
+  next_token(as);
+  if (!(cmp = is_compare(as))) error(as, "expected comparison");
 
-  next_token();
-  if ((reg_rhs = is_register_or_alias()))
-    encode_if_reg_cmp_reg(cmp, reg_lhs, reg_rhs);
+  next_token(as);
+  if ((reg_rhs = is_register_or_alias(as)))
+    encode_if_reg_cmp_reg(as, cmp, reg_lhs, reg_rhs);
   else {
-    if (!(cmp == EQ || cmp == NE)) error("unexpected comparison operator");
-    if (!is_number(&num)) error("invalid number");
+    if (!(cmp == EQ || cmp == NE)) error(as, "unexpected comparison operator");
+    if (!is_number(as, &num)) error(as, "invalid number");
 
     if (cmp == EQ)
-      encode_if_reg_eq_lit(reg_lhs, num);
+      encode_if_reg_eq_lit(as, reg_lhs, num);
     else
-      encode_if_reg_ne_lit(reg_lhs, num);
+      encode_if_reg_ne_lit(as, reg_lhs, num);
   }
 
-  next_token();
-  if (strcmp(token, "then") != 0) error("expected \"then\"");
+  next_token(as);
+  if (strcmp(as->token, "then") != 0) error(as, "expected \"then\"");
 }
 
-void parse_if_key() {
+void parse_if_key(asm_t *as) {
   keys_t key;
 
-  next_token();
-  if (!(key = is_key())) error("expected key in condition");
+  next_token(as);
+  if (!(key = is_key(as))) error(as, "expected key in condition");
 
-  encode_if_key(key);
+  encode_if_key(as, key);
 
-  next_token();
-  if (strcmp(token, "then") != 0) error("expected \"then\"");
+  next_token(as);
+  if (strcmp(as->token, "then") != 0) error(as, "expected \"then\"");
 }
 
-void parse_print() {
+void parse_print(asm_t *as) {
   reg_t reg;
 
-  next_token();
-  if (!(reg = is_register_or_alias())) error("expected register to print");
+  next_token(as);
+  if (!(reg = is_register_or_alias(as)))
+    error(as, "expected register to print");
 
-  encode_print(reg);
+  encode_print(as, reg);
 }
 
-void parse_clear() {
+void parse_clear(asm_t *as) {
   uint8_t col;
 
-  next_token();
-  if (!is_number(&col)) error("expected literal color");
+  next_token(as);
+  if (!is_number(as, &col)) error(as, "expected literal color");
 
-  encode_clear(col);
+  encode_clear(as, col);
 }
 
-int next_token_label() {
-  next_token();
-  if (label_n == LABEL_MAX) error("too many labels");
+int next_token_label(asm_t *as) {
+  next_token(as);
+  if (as->label_n == LABEL_MAX) error(as, "too many labels");
 
-  for (uint16_t i = 0; i < label_n; i++) {
-    if (strcmp(token, label[i]) == 0) {
+  for (uint16_t i = 0; i < as->label_n; i++) {
+    if (strcmp(as->token, as->label[i]) == 0) {
       return i;
     }
   }
   return -1;
 }
 
-void parse_sprite() {
+void parse_sprite(asm_t *as) {
   reg_t x;
   reg_t y;
   uint8_t col;
 
-  next_token();
-  if (!(x = is_register_or_alias())) error("expected register in sprite");
-  next_token();
-  if (!(y = is_register_or_alias())) error("expected register in sprite");
-  next_token();
-  if (!is_number(&col)) error("expected literal color");
+  next_token(as);
+  if (!(x = is_register_or_alias(as))) error(as, "expected register in sprite");
+  next_token(as);
+  if (!(y = is_register_or_alias(as))) error(as, "expected register in sprite");
+  next_token(as);
+  if (!is_number(as, &col)) error(as, "expected literal color");
 
-  encode_sprite(x, y, col);
+  encode_sprite(as, x, y, col);
 }
 
-void parse_point() {
+void parse_point(asm_t *as) {
   int i;
-  if (0 <= (i = next_token_label())) {
-    encode_point(i);
+  if (0 <= (i = next_token_label(as))) {
+    encode_point(as, i);
     return;
   }
 
-  strcpy(label[label_n], token);
-  label_offset[label_n] = 0;
-  encode_point(label_n);
-  label_n++;
+  strcpy(as->label[as->label_n], as->token);
+  as->label_offset[as->label_n] = 0;
+  as->label_line[as->label_n] = as->token_line;
+  as->label_column[as->label_n] = as->token_column;
+  encode_point(as, as->label_n);
+  as->label_n++;
 }
 
-void parse_label() {
+void parse_label(asm_t *as) {
   int i;
-  if (0 <= (i = next_token_label())) {
-    label_offset[i] = pc;
+  if (0 <= (i = next_token_label(as))) {
+    if (as->label_defined[i])
+      add_diag(as, DIAG_WARNING, as->token_line, as->token_column, as->token,
+               "label defined twice, the last one wins");
+    as->label_offset[i] = as->pc;
+    as->label_defined[i] = true;
     return;
   }
 
-  strcpy(label[label_n], token);
-  label_offset[label_n] = pc;
-  label_n++;
+  strcpy(as->label[as->label_n], as->token);
+  as->label_offset[as->label_n] = as->pc;
+  as->label_defined[as->label_n] = true;
+  as->label_line[as->label_n] = as->token_line;
+  as->label_column[as->label_n] = as->token_column;
+  as->label_n++;
 }
 
-void parse_goto() {
+void parse_goto(asm_t *as) {
   int i;
-  if (0 <= (i = next_token_label())) {
-    encode_goto(i);
+  if (0 <= (i = next_token_label(as))) {
+    encode_goto(as, i);
     return;
   }
 
-  strcpy(label[label_n], token);
-  label_offset[label_n] = 0;
-  encode_goto(label_n);
-  label_n++;
+  strcpy(as->label[as->label_n], as->token);
+  as->label_offset[as->label_n] = 0;
+  as->label_line[as->label_n] = as->token_line;
+  as->label_column[as->label_n] = as->token_column;
+  encode_goto(as, as->label_n);
+  as->label_n++;
 }
 
-void parse_save() {
-  encode_save();
+void parse_save(asm_t *as) {
+  encode_save(as);
   return;
 }
 
-void parse_load() {
-  encode_load();
+void parse_load(asm_t *as) {
+  encode_load(as);
   return;
 }
 
 /* PROCESS BYTECODE */
 
-void resolve_gotos() {
+void resolve_gotos(asm_t *as) {
+  // only where encode_goto and encode_point wrote, written data is left be
   uint8_t a, b, c;
-  uint16_t n;
+  uint16_t i, n;
 
-  for (uint16_t i = 0; i < pc; i += 4) {
-    if (mem[i] == GOTO || mem[i] == POINT) {
-      a = mem[i + 1];
-      b = mem[i + 2];
-      c = mem[i + 3];
+  for (uint16_t k = 0; k < as->fixup_n; k++) {
+    i = as->fixup[k];
+    a = as->mem[i + 1];
+    b = as->mem[i + 2];
+    c = as->mem[i + 3];
 
-      n = label_offset[(a << 8) | (b << 4) | c];
+    n = as->label_offset[(a << 8) | (b << 4) | c];
 
-      mem[i + 1] = (n & 0xf00) >> 8;
-      mem[i + 2] = (n & 0xf0) >> 4;
-      mem[i + 3] = (n & 0xf);
-    }
+    as->mem[i + 1] = (n & 0xf00) >> 8;
+    as->mem[i + 2] = (n & 0xf0) >> 4;
+    as->mem[i + 3] = (n & 0xf);
+  }
+}
+
+/* DEBUG INFO */
+
+int label_before(uint16_t at) {
+  // the defined label closest before at, or -1
+  int best = -1;
+
+  for (uint8_t i = 0; i < label_n; i++)
+    if (label_defined[i] && label_offset[i] <= at &&
+        (best < 0 || label_offset[i] >= label_offset[best]))
+      best = i;
+  return best;
+}
+
+/* DISASSEMBLER */
+
+const char *REG_NAME[] = {"?", "x", "y", "z", "w", "a", "b",
+                          "c", "d", "e", "f", "t"};
+const char *OP_NAME[] = {"?=", "=",  "+=", "-=", "*=",
+                         "/=", "%=", "&=", "|=", "^="};
+const char *CMP_NAME[] = {"?", "==", "!=", "<", "<=", ">", ">="};
+const char *KEY_NAME[] = {"?", "action", "up", "down", "left", "right"};
+
+const char *reg_name(uint8_t r) {
+  if (r == 0 || r > REGISTER_N - 1) return REG_NAME[0];
+  return alias[r - 1][0] ? alias[r - 1] : REG_NAME[r];
+}
+
+const char *target_name(uint16_t n) {
+  static char hex[8];
+
+  for (uint8_t i = 0; i < label_n; i++)
+    if (label_defined[i] && label_offset[i] == n) return label[i];
+  snprintf(hex, sizeof(hex), "0x%03x", n);
+  return hex;
+}
+
+void disassemble(const uint8_t *p, char *out, size_t n) {
+  // back to source form, with aliases and labels of the last assembled cart
+  uint8_t nn = p[2] * 0x10 + p[3];
+  uint16_t nnn = p[1] * 0x100 + p[2] * 0x10 + p[3];
+
+  switch (p[0]) {
+  case HALT:
+    snprintf(out, n, "halt");
+    break;
+  case SAVE:
+    snprintf(out, n, "save");
+    break;
+  case LOAD:
+    snprintf(out, n, "load");
+    break;
+  case GOTO:
+    snprintf(out, n, "goto %s", target_name(nnn));
+    break;
+  case POINT:
+    snprintf(out, n, "point %s", target_name(nnn));
+    break;
+  case PRINT:
+    snprintf(out, n, "print %s", reg_name(p[1]));
+    break;
+  case CLEAR:
+    snprintf(out, n, "clear %u", p[1]);
+    break;
+  case SPRITE:
+    snprintf(out, n, "sprite %s %s %u", reg_name(p[1]), reg_name(p[2]), p[3]);
+    break;
+  case REG_OP_REG:
+    snprintf(out, n, "%s %s %s", reg_name(p[2]),
+             OP_NAME[p[1] <= XOR ? p[1] : 0], reg_name(p[3]));
+    break;
+  case REG_SET_LIT:
+    snprintf(out, n, "%s = %u", reg_name(p[1]), nn);
+    break;
+  case REG_ADD_LIT:
+    snprintf(out, n, "%s += %u", reg_name(p[1]), nn);
+    break;
+  case REG_RANDOM:
+    snprintf(out, n, "%s = random %u", reg_name(p[1]), nn);
+    break;
+  case IF_REG_CMP_REG:
+    snprintf(out, n, "if %s %s %s then", reg_name(p[2]),
+             CMP_NAME[p[1] <= GE ? p[1] : 0], reg_name(p[3]));
+    break;
+  case IF_REG_EQ_LIT:
+    snprintf(out, n, "if %s == %u then", reg_name(p[1]), nn);
+    break;
+  case IF_REG_NE_LIT:
+    snprintf(out, n, "if %s != %u then", reg_name(p[1]), nn);
+    break;
+  case IF_KEY:
+    snprintf(out, n, "key %s then", KEY_NAME[p[1] <= KRIGHT ? p[1] : 0]);
+    break;
+  case TRAP:
+    snprintf(out, n, "trap");
+    break;
+  default:
+    snprintf(out, n, "write %u", p[0]);
+    break;
   }
 }
 
 /* READER */
 
-void read_file(char *name) {
-  file = fopen(name, "r");
-  if (file == NULL) error("couldn't open file");
+void reset_assembler(asm_t *as) {
+  memset(as->mem, 0, sizeof(as->mem));
+  memset(as->alias, 0, sizeof(as->alias));
+  memset(as->label_defined, 0, sizeof(as->label_defined));
+  memset(as->line_at, 0, sizeof(as->line_at));
+  as->pc = 0;
+  as->line = 1;
+  as->column = 0;
+  as->token_line = 1;
+  as->token_column = 1;
+  as->label_n = 0;
+  as->fixup_n = 0;
+  as->diag_n = 0;
+}
+
+bool run_assembler(asm_t *as, const char *source, size_t len) {
+  uint16_t start;
+
+  reset_assembler(as);
+  as->src = source;
+  as->src_len = len;
+  as->src_at = 0;
+  if (setjmp(as->error_jump)) return false;
 
   // code section
-  while (scan_token() != NULL) {
-    if (strcmp(token, "write") == 0)
-      parse_write();
-    else if (strcmp(token, "alias") == 0)
-      parse_alias();
-    else if (is_register_or_alias())
-      parse_assign();
-    else if (strcmp(token, "print") == 0)
-      parse_print();
-    else if (strcmp(token, "clear") == 0)
-      parse_clear();
-    else if (strcmp(token, "point") == 0)
-      parse_point();
-    else if (strcmp(token, "sprite") == 0)
-      parse_sprite();
-    else if (strcmp(token, "if") == 0)
-      parse_if();
-    else if (strcmp(token, "key") == 0)
-      parse_if_key();
-    else if (strcmp(token, ":") == 0)
-      parse_label();
-    else if (strcmp(token, "goto") == 0)
-      parse_goto();
-    else if (strcmp(token, "save") == 0)
-      parse_save();
-    else if (strcmp(token, "load") == 0)
-      parse_load();
+  while (scan_token(as) != NULL) {
+    start = as->pc;
+    // room for the longest statement and the final halt
+    if (as->pc > MEMORY_SIZE - 8) error(as, "program too large");
+
+    if (strcmp(as->token, "write") == 0)
+      parse_write(as);
+    else if (strcmp(as->token, "alias") == 0)
+      parse_alias(as);
+    else if (is_register_or_alias(as))
+      parse_assign(as);
+    else if (strcmp(as->token, "print") == 0)
+      parse_print(as);
+    else if (strcmp(as->token, "clear") == 0)
+      parse_clear(as);
+    else if (strcmp(as->token, "point") == 0)
+      parse_point(as);
+    else if (strcmp(as->token, "sprite") == 0)
+      parse_sprite(as);
+    else if (strcmp(as->token, "if") == 0)
+      parse_if(as);
+    else if (strcmp(as->token, "key") == 0)
+      parse_if_key(as);
+    else if (strcmp(as->token, ":") == 0)
+      parse_label(as);
+    else if (strcmp(as->token, "goto") == 0)
+      parse_goto(as);
+    else if (strcmp(as->token, "save") == 0)
+      parse_save(as);
+    else if (strcmp(as->token, "load") == 0)
+      parse_load(as);
     else
-      error("invalid instruction");
+      error(as, "invalid instruction");
+
+    // keep the source line of every byte for profiles and traces
+    while (start < as->pc) as->line_at[start++] = as->token_line;
   }
-  encode_halt();
+  start = as->pc;
+  encode_halt(as);
+  while (start < as->pc) as->line_at[start++] = as->line;
+
+  // these jump to 0, which is rarely what was meant
+  for (uint8_t i = 0; i < as->label_n; i++)
+    if (!as->label_defined[i])
+      add_diag(as, DIAG_WARNING, as->label_line[i], as->label_column[i],
+               as->label[i], "label never defined");
+
+  resolve_gotos(as);
+  return true;
+}
+
+bool assemble(const char *source, size_t len) {
+  static asm_t as;
+  bool ok = run_assembler(&as, source, len);
+
+  memcpy(diag, as.diag, sizeof(diag));
+  diag_n = as.diag_n;
+  memcpy(label, as.label, sizeof(label));
+  label_n = as.label_n;
+  memcpy(label_offset, as.label_offset, sizeof(label_offset));
+  memcpy(label_defined, as.label_defined, sizeof(label_defined));
+  memcpy(line_at, as.line_at, sizeof(line_at));
+  memcpy(mem, as.mem, sizeof(mem));
+  pc = as.pc;
+  memcpy(alias, as.alias, sizeof(alias));
+  return ok;
+}
+
+bool baya_assemble(const char *src, size_t len, cart_t *cart) {
+  asm_t *as = malloc(sizeof(asm_t));
+  bool ok = run_assembler(as, src, len);
+
+  memcpy(cart->image, as->mem, MEMORY_SIZE);
+  cart->size = ok ? as->pc : 0;
+  memcpy(cart->diags, as->diag, as->diag_n * sizeof(diag_t));
+  cart->diag_n = as->diag_n;
+  free(as);
+  return ok;
+}
+
+void print_diags(FILE *f, const diag_t *d, uint8_t n) {
+  for (uint8_t i = 0; i < n; i++)
+    fprintf(f, "%s AROUND LINE %d: %s%s%s%s\n",
+            d[i].level == DIAG_ERROR ? "ERROR" : "WARNING", d[i].line,
+            d[i].msg, d[i].token[0] ? " (\"" : "", d[i].token,
+            d[i].token[0] ? "\")" : "");
+}
 
-  resolve_gotos();
+char *read_source(const char *name, size_t *len) {
+  FILE *file = fopen(name, "rb");
+  char *buf = NULL;
+  size_t n = 0, cap = 0;
 
+  if (file == NULL) return NULL;
+  do {
+    if (n == cap) buf = realloc(buf, cap = cap ? cap * 2 : 4096);
+    n += fread(buf + n, 1, cap - n, file);
+  } while (n == cap);
   fclose(file);
+  *len = n;
+  return buf;
+}
+
+void read_file(char *name) {
+  size_t n;
+  char *buf = read_source(name, &n);
+  bool ok;
+
+  if (buf == NULL) {
+    printf("ERROR AROUND LINE 1: couldn't open file\n");
+    exit(1);
+  }
+
+  ok = assemble(buf, n);
+  free(buf);
+  print_diags(ok ? stderr : stdout, diag, diag_n);
+  if (!ok) exit(1);
+}
+
+/* RANDOM */
+
+void seed_random(vm_t *vm, uint32_t seed) {
+  // a zero state would make xorshift return 0 forever
+  vm->rng = seed ? seed : RANDOM_SEED;
+}
+
+uint32_t next_random(uint32_t *rng) {
+  uint32_t x = *rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *rng = x;
+}
+
+uint8_t random_below(uint32_t *rng, uint8_t n) {
+  // multiply and reject (Lemire), so every value in 0..n-1 is equally likely
+  uint64_t m;
+  uint32_t threshold;
+
+  if (n == 0) return 0;
+
+  m = (uint64_t)next_random(rng) * n;
+  if ((uint32_t)m < n) {
+    threshold = -(uint32_t)n % n;
+    while ((uint32_t)m < threshold) m = (uint64_t)next_random(rng) * n;
+  }
+  return m >> 32;
+}
+
+/* VM */
+
+void init_vm(vm_t *vm, const uint8_t *image) {
+  memcpy(vm->mem, image, MEMORY_SIZE);
+  memset(vm->regs, 0, REGISTER_N);
+  vm->pc = 0;
+  vm->sp = MEMORY_SIZE - 1;
+  vm->ip = 0;
+  seed_random(vm, RANDOM_SEED);
+  memset(vm->screen, 0, sizeof(vm->screen));
+  vm->keys = 0;
+  vm->out = stdout;
+  vm->print = NULL;
+  vm->profile = NULL;
+  vm->trace = NULL;
+  vm->counts = NULL;
+  vm->trap = NULL;
+  vm->budget = 0;
+  vm->no_draw = false;
+  vm->guarded = false;
+  vm->stack_floor = 0;
+  vm->fault = 0;
+}
+
+/* SNAPSHOT */
+
+void baya_snapshot(const vm_t *vm, uint8_t *blob) {
+  memcpy(blob, vm->mem, MEMORY_SIZE);
+  blob += MEMORY_SIZE;
+  memcpy(blob, vm->regs, REGISTER_N);
+  blob += REGISTER_N;
+
+  *blob++ = vm->pc & 0xff;
+  *blob++ = vm->pc >> 8;
+  *blob++ = vm->sp & 0xff;
+  *blob++ = vm->sp >> 8;
+  *blob++ = vm->ip & 0xff;
+  *blob++ = vm->ip >> 8;
+
+  *blob++ = vm->rng & 0xff;
+  *blob++ = (vm->rng >> 8) & 0xff;
+  *blob++ = (vm->rng >> 16) & 0xff;
+  *blob++ = vm->rng >> 24;
+
+  memcpy(blob, vm->screen, sizeof(vm->screen));
+}
+
+void baya_restore(vm_t *vm, const uint8_t *blob) {
+  memcpy(vm->mem, blob, MEMORY_SIZE);
+  blob += MEMORY_SIZE;
+  memcpy(vm->regs, blob, REGISTER_N);
+  blob += REGISTER_N;
+
+  vm->pc = blob[0] | blob[1] << 8;
+  vm->sp = blob[2] | blob[3] << 8;
+  vm->ip = blob[4] | blob[5] << 8;
+  blob += 6;
+
+  vm->rng = (uint32_t)blob[0] | (uint32_t)blob[1] << 8 |
+            (uint32_t)blob[2] << 16 | (uint32_t)blob[3] << 24;
+  if (vm->rng == 0) vm->rng = RANDOM_SEED;
+  blob += 4;
+
+  memcpy(vm->screen, blob, sizeof(vm->screen));
+}
+
+uint64_t baya_hash(const vm_t *vm) {
+  // fnv-1a over the snapshot taken 8 bytes at a time, little endian, and
+  // mixed at the end so every bit of the state reaches every bit of the hash
+  uint8_t blob[SNAPSHOT_SIZE];
+  uint64_t h = 0xcbf29ce484222325ull, w;
+  size_t i;
+
+  baya_snapshot(vm, blob);
+  for (i = 0; i + 8 <= SNAPSHOT_SIZE; i += 8) {
+    w = 0;
+    for (uint8_t j = 0; j < 8; j++) w |= (uint64_t)blob[i + j] << 8 * j;
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  for (; i < SNAPSHOT_SIZE; i++) h = (h ^ blob[i]) * 0x100000001b3ull;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
 }
 
 /* GET FROM MEMORY */
 
-uint8_t get_reg() {
-  uint8_t c = mem[pc++];
+uint8_t get_reg(vm_t *vm) {
+  uint8_t c = vm->mem[vm->pc++];
   return c - 1;
 }
 
-uint8_t get_N() { return mem[pc++]; }
+uint8_t get_N(vm_t *vm) { return vm->mem[vm->pc++]; }
 
-uint8_t get_NN() {
-  uint8_t a = mem[pc++];
-  uint8_t b = mem[pc++];
+uint8_t get_NN(vm_t *vm) {
+  uint8_t a = vm->mem[vm->pc++];
+  uint8_t b = vm->mem[vm->pc++];
   return a * 0x10 + b;
 }
 
-uint16_t get_NNN() {
-  uint8_t a = mem[pc++];
-  uint8_t b = mem[pc++];
-  uint8_t c = mem[pc++];
+uint16_t get_NNN(vm_t *vm) {
+  uint8_t a = vm->mem[vm->pc++];
+  uint8_t b = vm->mem[vm->pc++];
+  uint8_t c = vm->mem[vm->pc++];
   return a * 0x100 + b * 0x10 + c;
 }
 
 /* EXECUTION FUNCTIONS */
 
-void print_register() {
-  printf("%d\n", regs[get_reg()]);
-  pc += 2;
+void print_register(vm_t *vm) {
+  uint8_t r = get_reg(vm);
+  uint8_t v = vm->regs[r];
+
+  if (vm->print)
+    push_print(vm->print, vm->print->id, r + 1, v);
+  else if (vm->out)
+    fprintf(vm->out, "%d\n", v);
+  vm->pc += 2;
 }
 
-void clear_screen() {
-  ClearBackground(PALETTE[get_N()]);
-  pc += 2;
+void clear_screen(vm_t *vm) {
+  memset(vm->screen, get_N(vm) & (PALETTE_SIZE - 1), sizeof(vm->screen));
+  vm->pc += 2;
 }
 
-void draw_sprite() {
-  uint8_t *spr = &mem[ip];
-  uint8_t ox = regs[get_reg()];
-  uint8_t oy = regs[get_reg()];
-  Color col = PALETTE[get_N()];
+void draw_sprite(vm_t *vm) {
+  uint8_t *spr = &vm->mem[vm->ip];
+  uint8_t ox = vm->regs[get_reg(vm)];
+  uint8_t oy = vm->regs[get_reg(vm)];
+  uint8_t col = get_N(vm) & (PALETTE_SIZE - 1);
 
-  for (size_t x = 0; x < 8; x++)
-    for (size_t y = 0; y < 4; y++)
-      if (spr[y] & (128 >> x))
-        DrawRectangle((ox + x) * scale, (oy + y) * scale, scale, scale, col);
+  // anything past the right or bottom edge is clipped
+  for (size_t y = 0; y < 4 && oy + y < SCREEN_HEIGHT; y++)
+    for (size_t x = 0; x < 8 && ox + x < SCREEN_WIDTH; x++)
+      if (spr[y] & (128 >> x)) vm->screen[oy + y][ox + x] = col;
 }
 
-void save_registers() {
+void save_registers(vm_t *vm) {
   // save registers x..z and a..f
-  mem[sp--] = regs[RX - 1];
-  mem[sp--] = regs[RY - 1];
-  mem[sp--] = regs[RZ - 1];
-  mem[sp--] = regs[RA - 1];
-  mem[sp--] = regs[RB - 1];
-  mem[sp--] = regs[RC - 1];
-  mem[sp--] = regs[RD - 1];
-  mem[sp--] = regs[RE - 1];
-  mem[sp--] = regs[RF - 1];
-  pc += 3;
-}
-
-void load_registers() {
+  vm->mem[vm->sp--] = vm->regs[RX - 1];
+  vm->mem[vm->sp--] = vm->regs[RY - 1];
+  vm->mem[vm->sp--] = vm->regs[RZ - 1];
+  vm->mem[vm->sp--] = vm->regs[RA - 1];
+  vm->mem[vm->sp--] = vm->regs[RB - 1];
+  vm->mem[vm->sp--] = vm->regs[RC - 1];
+  vm->mem[vm->sp--] = vm->regs[RD - 1];
+  vm->mem[vm->sp--] = vm->regs[RE - 1];
+  vm->mem[vm->sp--] = vm->regs[RF - 1];
+  vm->pc += 3;
+}
+
+void load_registers(vm_t *vm) {
   // load registers x..z and a..f
-  regs[RF - 1] = mem[++sp];
-  regs[RE - 1] = mem[++sp];
-  regs[RD - 1] = mem[++sp];
-  regs[RC - 1] = mem[++sp];
-  regs[RB - 1] = mem[++sp];
-  regs[RA - 1] = mem[++sp];
-  regs[RZ - 1] = mem[++sp];
-  regs[RY - 1] = mem[++sp];
-  regs[RX - 1] = mem[++sp];
-  pc += 3;
-}
-
-void assign_register_to_register() {
-  op_t op = mem[pc++];
-  uint8_t reg_n = get_reg();
+  vm->regs[RF - 1] = vm->mem[++vm->sp];
+  vm->regs[RE - 1] = vm->mem[++vm->sp];
+  vm->regs[RD - 1] = vm->mem[++vm->sp];
+  vm->regs[RC - 1] = vm->mem[++vm->sp];
+  vm->regs[RB - 1] = vm->mem[++vm->sp];
+  vm->regs[RA - 1] = vm->mem[++vm->sp];
+  vm->regs[RZ - 1] = vm->mem[++vm->sp];
+  vm->regs[RY - 1] = vm->mem[++vm->sp];
+  vm->regs[RX - 1] = vm->mem[++vm->sp];
+  vm->pc += 3;
+}
+
+void assign_register_to_register(vm_t *vm) {
+  op_t op = vm->mem[vm->pc++];
+  uint8_t reg_n = get_reg(vm);
+  uint8_t *regs = vm->regs;
 
   switch (op) {
   case SET:
-    regs[reg_n] = regs[get_reg()];
+    regs[reg_n] = regs[get_reg(vm)];
     break;
   case ADD:
-    regs[reg_n] += regs[get_reg()];
+    regs[reg_n] += regs[get_reg(vm)];
     break;
   case SUB:
-    regs[reg_n] -= regs[get_reg()];
+    regs[reg_n] -= regs[get_reg(vm)];
     break;
   case MUL:
-    regs[reg_n] *= regs[get_reg()];
+    regs[reg_n] *= regs[get_reg(vm)];
     break;
   case DIV:
-    regs[reg_n] /= regs[get_reg()];
+    regs[reg_n] /= regs[get_reg(vm)];
     break;
   case MOD:
-    regs[reg_n] %= regs[get_reg()];
+    regs[reg_n] %= regs[get_reg(vm)];
     break;
   case AND:
-    regs[reg_n] &= regs[get_reg()];
+    regs[reg_n] &= regs[get_reg(vm)];
     break;
   case OR:
-    regs[reg_n] |= regs[get_reg()];
+    regs[reg_n] |= regs[get_reg(vm)];
     break;
   case XOR:
-    regs[reg_n] ^= regs[get_reg()];
+    regs[reg_n] ^= regs[get_reg(vm)];
     break;
   }
 }
 
-void if_reg_cmp_reg_is_false_skip_next_instruction() {
-  cmp_t cmp = mem[pc++];
-  uint8_t a = regs[get_reg()];
-  uint8_t b = regs[get_reg()];
+void if_reg_cmp_reg_is_false_skip_next_instruction(vm_t *vm) {
+  cmp_t cmp = vm->mem[vm->pc++];
+  uint8_t a = vm->regs[get_reg(vm)];
+  uint8_t b = vm->regs[get_reg(vm)];
 
   switch (cmp) {
   case EQ:
-    if (!(a == b)) pc += 4;
+    if (!(a == b)) vm->pc += 4;
     break;
   case NE:
-    if (!(a != b)) pc += 4;
+    if (!(a != b)) vm->pc += 4;
     break;
   case LT:
-    if (!(a < b)) pc += 4;
+    if (!(a < b)) vm->pc += 4;
     break;
   case LE:
-    if (!(a <= b)) pc += 4;
+    if (!(a <= b)) vm->pc += 4;
     break;
   case GT:
-    if (!(a > b)) pc += 4;
+    if (!(a > b)) vm->pc += 4;
     break;
   case GE:
-    if (!(a >= b)) pc += 4;
+    if (!(a >= b)) vm->pc += 4;
     break;
   }
 }
 
-void if_reg_eq_lit_is_false_skip_next_instruction() {
-  uint8_t r_val = regs[get_reg()];
-  uint8_t n = get_NN();
+void if_reg_eq_lit_is_false_skip_next_instruction(vm_t *vm) {
+  uint8_t r_val = vm->regs[get_reg(vm)];
+  uint8_t n = get_NN(vm);
 
-  if (!(r_val == n)) pc += 4;
+  if (!(r_val == n)) vm->pc += 4;
 }
 
-void if_reg_ne_lit_is_false_skip_next_instruction() {
-  uint8_t r_val = regs[get_reg()];
-  uint8_t n = get_NN();
+void if_reg_ne_lit_is_false_skip_next_instruction(vm_t *vm) {
+  uint8_t r_val = vm->regs[get_reg(vm)];
+  uint8_t n = get_NN(vm);
 
-  if (!(r_val != n)) pc += 4;
+  if (!(r_val != n)) vm->pc += 4;
 }
 
-void if_not_key_skip_next_instruction() {
-  keys_t key = mem[pc++];
-  pc += 2;
+void if_not_key_skip_next_instruction(vm_t *vm) {
+  keys_t key = vm->mem[vm->pc++];
+  vm->pc += 2;
 
-  switch (key) {
-  case KACTION:
-    if (!(IsKeyDown(KEY_SPACE) || IsKeyDown(KEY_ENTER))) pc += 4;
-    break;
-  case KUP:
-    if (!(IsKeyDown(KEY_UP) || IsKeyDown(KEY_W))) pc += 4;
+  if (KACTION <= key && key <= KRIGHT && !(vm->keys & (1 << (key - 1))))
+    vm->pc += 4;
+}
+
+/* EXECUTION */
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void trace_step(vm_t *vm, uint16_t at, ins_t o) {
+  // the register an instruction wrote, if any, and its new value
+  uint8_t reg = 0;
+
+  switch (o) {
+  case REG_OP_REG:
+    reg = vm->mem[(at + 2) & (MEMORY_SIZE - 1)];
     break;
-  case KDOWN:
-    if (!(IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S))) pc += 4;
+  case REG_SET_LIT:
+  case REG_ADD_LIT:
+  case REG_RANDOM:
+    reg = vm->mem[(at + 1) & (MEMORY_SIZE - 1)];
     break;
-  case KLEFT:
-    if (!(IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A))) pc += 4;
+  case LOAD:
+    reg = TRACE_ALL;
     break;
-  case KRIGHT:
-    if (!(IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D))) pc += 4;
+  default:
     break;
   }
+  if (reg > REGISTER_N && reg != TRACE_ALL) reg = 0;
+
+  push_trace(vm->trace,
+             TRACE_RECORD(at, o, reg,
+                          reg && reg <= REGISTER_N ? vm->regs[reg - 1] : 0));
 }
 
-/* EXECUTION */
+const char *FAULT_NAME[] = {
+    "none",           "pc out of memory", "bad opcode",
+    "bad register",   "bad operand",      "address out of memory",
+    "stack overflow", "stack underflow",  "division by zero",
+    "out of budget",
+};
+
+static inline fault_t check_operands(const vm_t *vm, const uint8_t *p) {
+  // the instruction itself, then what depends on the state it runs in
+  fault_t f = check_code(p, vm->trap);
+
+  if (f) return f;
+  switch (p[0]) {
+  // a save down to a floor of 0 leaves sp wrapped round below it
+  case SAVE:
+    return vm->sp < vm->stack_floor + 8 || vm->sp >= MEMORY_SIZE
+               ? FAULT_STACK_OVERFLOW
+               : 0;
+  case LOAD:
+    return (uint16_t)(vm->sp + 1) > MEMORY_SIZE - 9 ? FAULT_STACK_UNDERFLOW
+                                                    : 0;
+  case REG_OP_REG:
+    if ((p[1] == DIV || p[1] == MOD) && vm->regs[p[3] - 1] == 0)
+      return FAULT_DIVIDE;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+static inline bool check_ins(vm_t *vm, uint16_t at) {
+  fault_t f = at > MEMORY_SIZE - 4 ? FAULT_PC
+                                   : check_operands(vm, &vm->mem[at]);
+
+  if (f) {
+    vm->fault = f;
+    vm->pc = at;
+  }
+  return !f;
+}
 
-void exec() {
+// flags are constants in every caller, so each variant of exec is compiled
+// with its extra work folded in and the plain one pays nothing for them
+static inline __attribute__((always_inline)) bool exec_with(vm_t *vm,
+                                                            int flags) {
   ins_t o;
   uint8_t reg_n;
+  uint16_t at;
+  uint64_t t0 = 0;
+
+  for (;;) {
+    at = vm->pc++;
+    // a fault ends the frame like a halt, with pc left on it
+    if (flags & EXEC_CHECK && !check_ins(vm, at)) return true;
+    if (!(o = vm->mem[at])) break;
+
+    if (flags & EXEC_BUDGET && vm->budget-- == 0) {
+      vm->budget = 0;
+      vm->fault = FAULT_BUDGET;
+      vm->pc = at;
+      return true;
+    }
+    if (flags & EXEC_COUNT) vm->counts->instructions++;
+    if (flags & EXEC_PROFILE) {
+      vm->profile->ops[o & 0xff]++;
+      vm->profile->at[at & (MEMORY_SIZE - 1)]++;
+    }
 
-  while ((o = mem[pc++])) {
     switch (o) {
     case HALT:
-      return;
+      if (flags & EXEC_TRACE) trace_step(vm, at, o);
+      return true;
     case SAVE:
-      save_registers();
+      save_registers(vm);
       break;
     case LOAD:
-      load_registers();
+      load_registers(vm);
       break;
     case GOTO:
-      pc = get_NNN();
+      vm->pc = get_NNN(vm);
       break;
     case POINT:
-      ip = get_NNN();
+      vm->ip = get_NNN(vm);
       break;
     case PRINT:
-      print_register();
+      print_register(vm);
       break;
     case CLEAR:
-      clear_screen();
+      if (flags & EXEC_NO_DRAW) {
+        vm->pc += 3;
+        break;
+      }
+      if (flags & EXEC_PROFILE) t0 = now_ns();
+      clear_screen(vm);
+      if (flags & EXEC_PROFILE) vm->profile->clear_ns += now_ns() - t0;
       break;
     case SPRITE:
-      draw_sprite();
+      if (flags & EXEC_COUNT) vm->counts->sprites++;
+      if (flags & EXEC_NO_DRAW) {
+        vm->pc += 3;
+        break;
+      }
+      if (flags & EXEC_PROFILE) t0 = now_ns();
+      draw_sprite(vm);
+      if (flags & EXEC_PROFILE) vm->profile->sprite_ns += now_ns() - t0;
       break;
     case REG_OP_REG:
-      assign_register_to_register();
+      assign_register_to_register(vm);
       break;
     case IF_REG_CMP_REG:
-      if_reg_cmp_reg_is_false_skip_next_instruction();
+      if_reg_cmp_reg_is_false_skip_next_instruction(vm);
       break;
     case IF_REG_EQ_LIT:
-      if_reg_eq_lit_is_false_skip_next_instruction();
+      if_reg_eq_lit_is_false_skip_next_instruction(vm);
       break;
     case IF_REG_NE_LIT:
-      if_reg_ne_lit_is_false_skip_next_instruction();
+      if_reg_ne_lit_is_false_skip_next_instruction(vm);
       break;
     case IF_KEY:
-      if_not_key_skip_next_instruction();
+      if_not_key_skip_next_instruction(vm);
       break;
     case REG_SET_LIT:
-      reg_n = get_reg();
-      regs[reg_n] = get_NN();
+      reg_n = get_reg(vm);
+      vm->regs[reg_n] = get_NN(vm);
       break;
     case REG_ADD_LIT:
-      reg_n = get_reg();
-      regs[reg_n] += get_NN();
+      reg_n = get_reg(vm);
+      vm->regs[reg_n] += get_NN(vm);
       break;
     case REG_RANDOM:
-      reg_n = get_reg();
-      regs[reg_n] = (float)rand() / RAND_MAX * get_NN();
+      reg_n = get_reg(vm);
+      vm->regs[reg_n] = random_below(&vm->rng, get_NN(vm));
+      break;
+    case TRAP:
+      // breakpoints cost nothing until one is hit, and without a debugger
+      // the byte stays the no-op it always was
+      if (vm->trap && !(flags & EXEC_STEP)) {
+        vm->pc = at;
+        return false;
+      }
       break;
     }
+
+    if (flags & EXEC_TRACE) trace_step(vm, at, o);
+    if (flags & EXEC_STEP) return false;
   }
+  return true;
 }
 
-/* MAIN */
+// -DBAYA_CHECKED compiles every variant below with the checks in, and
+// without it they are left out entirely
+#ifdef BAYA_CHECKED
+#define EXEC_BUILD EXEC_CHECK
+#else
+#define EXEC_BUILD 0
+#endif
+
+bool exec(vm_t *vm) { return exec_with(vm, EXEC_BUILD); }
+
+bool exec_profiled(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_PROFILE);
+}
+
+bool exec_traced(vm_t *vm) { return exec_with(vm, EXEC_BUILD | EXEC_TRACE); }
+
+bool exec_profiled_traced(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_PROFILE | EXEC_TRACE);
+}
 
-int main(void) {
-  read_file("game.baya");
+bool exec_counted(vm_t *vm) { return exec_with(vm, EXEC_BUILD | EXEC_COUNT); }
 
-  for (int i = 0; i < pc; i++) {
-    printf("%x", mem[i]);
+bool exec_counted_profiled(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_COUNT | EXEC_PROFILE);
+}
+
+bool exec_counted_traced(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_COUNT | EXEC_TRACE);
+}
+
+bool exec_counted_profiled_traced(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_COUNT | EXEC_PROFILE | EXEC_TRACE);
+}
+
+bool exec_step(vm_t *vm) { return exec_with(vm, EXEC_BUILD | EXEC_STEP); }
+
+bool exec_budgeted(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_BUDGET);
+}
+
+bool exec_undrawn(vm_t *vm) {
+  return exec_with(vm, EXEC_BUILD | EXEC_NO_DRAW);
+}
+
+// the one variant checked in every build, for carts from anyone
+bool exec_guarded(vm_t *vm) {
+  return exec_with(vm, EXEC_CHECK | EXEC_BUDGET);
+}
+
+// indexed by the flags a vm asks for
+bool (*const EXEC_VARIANT[])(vm_t *vm) = {
+    exec,
+    exec_profiled,
+    exec_traced,
+    exec_profiled_traced,
+    exec_counted,
+    exec_counted_profiled,
+    exec_counted_traced,
+    exec_counted_profiled_traced,
+};
+
+void run_frame(vm_t *vm) {
+  int flags = (vm->profile ? EXEC_PROFILE : 0) | (vm->trace ? EXEC_TRACE : 0) |
+              (vm->counts ? EXEC_COUNT : 0);
+  // profiles and traces want the drawing in them, so only a plain run skips
+  bool (*run)(vm_t *vm) =
+      vm->guarded                 ? exec_guarded
+      : flags == 0 && vm->no_draw ? exec_undrawn
+                                  : EXEC_VARIANT[flags];
+  bool halted = run(vm);
+
+  // a trap leaves pc on itself, the debugger picks the frame up from there
+  // and hands it back to run at full speed
+  while (!halted) halted = vm->trap(vm) || run(vm);
+
+  // a fault keeps pc where it happened and the cart stays stopped
+  if (vm->fault) return;
+  vm->pc = 0;
+  vm->regs[RT - 1]++;
+  if (vm->print) vm->print->t++;
+}
+
+/* REWIND */
+
+void init_rewind(rewind_t *rw, uint32_t seconds) {
+  rw->frames = seconds * FPS;
+  rw->deltas = calloc(rw->frames, sizeof(uint8_t *));
+  rw->delta_len = calloc(rw->frames, sizeof(uint16_t));
+  rw->delta_cap = calloc(rw->frames, sizeof(uint16_t));
+  rw->first = 0;
+  rw->n = 0;
+  rw->started = false;
+}
+
+void free_rewind(rewind_t *rw) {
+  for (uint32_t i = 0; i < rw->frames; i++) free(rw->deltas[i]);
+  free(rw->deltas);
+  free(rw->delta_len);
+  free(rw->delta_cap);
+}
+
+uint16_t put_run(uint8_t *out, uint16_t n) {
+  // one byte below 128, two above (a snapshot is shorter than 1 << 14)
+  if (n < 0x80) {
+    out[0] = n;
+    return 1;
   }
-  putchar('\n');
+  out[0] = 0x80 | (n >> 8);
+  out[1] = n & 0xff;
+  return 2;
+}
 
-  SetTraceLogLevel(LOG_ERROR);
-  InitWindow(SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale, "🫐 baya");
-  SetTargetFPS(12);
+uint16_t get_run(const uint8_t **in) {
+  uint16_t n = *(*in)++;
+  if (n & 0x80) n = (n & 0x7f) << 8 | *(*in)++;
+  return n;
+}
 
-  while (!WindowShouldClose()) {
-    BeginDrawing();
+uint16_t encode_delta(const uint8_t *a, const uint8_t *b, uint8_t *out) {
+  // pairs of (unchanged bytes, changed bytes) followed by the changed
+  // bytes xor'ed, the worst case is 3 bytes out for every 2 bytes in
+  uint16_t i = 0;
+  uint16_t len = 0;
+  uint16_t start;
+  uint64_t wa, wb;
+
+  while (i < SNAPSHOT_SIZE) {
+    start = i;
+    while (i + 8 <= SNAPSHOT_SIZE) {
+      memcpy(&wa, a + i, 8);
+      memcpy(&wb, b + i, 8);
+      if (wa != wb) break;
+      i += 8;
+    }
+    while (i < SNAPSHOT_SIZE && a[i] == b[i]) i++;
+    len += put_run(out + len, i - start);
+
+    start = i;
+    while (i < SNAPSHOT_SIZE && a[i] != b[i]) i++;
+    len += put_run(out + len, i - start);
+    for (uint16_t j = start; j < i; j++) out[len++] = a[j] ^ b[j];
+  }
+  return len;
+}
 
-    exec();
-    pc = 0;
-    regs[RT - 1]++;
+void apply_delta(uint8_t *state, const uint8_t *delta, uint16_t len) {
+  const uint8_t *end = delta + len;
+  uint16_t i = 0;
+  uint16_t n;
 
-    EndDrawing();
+  while (delta < end) {
+    i += get_run(&delta);
+    n = get_run(&delta);
+    while (n--) state[i++] ^= *delta++;
   }
+}
 
-  CloseWindow();
+void record_frame(rewind_t *rw, const vm_t *vm) {
+  static uint8_t state[SNAPSHOT_SIZE];
+  static uint8_t delta[SNAPSHOT_SIZE * 2];
+  uint32_t slot;
+  uint16_t len;
 
-  return 0;
+  baya_snapshot(vm, state);
+  if (!rw->started) {
+    memcpy(rw->head, state, SNAPSHOT_SIZE);
+    rw->started = true;
+    return;
+  }
+
+  len = encode_delta(state, rw->head, delta);
+  memcpy(rw->head, state, SNAPSHOT_SIZE);
+
+  // once full, the oldest delta is dropped to make room
+  if (rw->n == rw->frames) {
+    rw->first = (rw->first + 1) % rw->frames;
+    rw->n--;
+  }
+  slot = (rw->first + rw->n++) % rw->frames;
+
+  if (rw->delta_cap[slot] < len) {
+    rw->deltas[slot] = realloc(rw->deltas[slot], len);
+    rw->delta_cap[slot] = len;
+  }
+  memcpy(rw->deltas[slot], delta, len);
+  rw->delta_len[slot] = len;
+}
+
+bool rewind_frame(rewind_t *rw, vm_t *vm) {
+  uint32_t slot;
+
+  if (rw->n == 0) return false;
+
+  slot = (rw->first + --rw->n) % rw->frames;
+  apply_delta(rw->head, rw->deltas[slot], rw->delta_len[slot]);
+  baya_restore(vm, rw->head);
+  return true;
+}
+
+size_t rewind_bytes(const rewind_t *rw) {
+  size_t n = 0;
+  for (uint32_t i = 0; i < rw->n; i++)
+    n += rw->delta_len[(rw->first + i) % rw->frames];
+  return n;
 }
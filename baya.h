@@ -0,0 +1,665 @@
+#ifndef BAYA_H
+#define BAYA_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "raylib.h"
+
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+#define FPS 12
+#define TOKEN_LENGTH 32
+#define LABEL_MAX 64
+
+#define PALETTE_SIZE 8
+
+#define MEMORY_SIZE (1 << 12)
+#define REGISTER_N 12
+#define RANDOM_SEED 0x2545f491
+
+extern Color PALETTE[PALETTE_SIZE];
+
+// assembler output
+extern uint8_t mem[MEMORY_SIZE];
+extern uint16_t pc;
+
+// debug info of the last assembled cart
+extern char label[LABEL_MAX][TOKEN_LENGTH];
+extern uint8_t label_n;
+extern uint16_t label_offset[LABEL_MAX];
+extern bool label_defined[LABEL_MAX];
+extern uint16_t line_at[MEMORY_SIZE]; // source line of every byte
+
+extern const char *INS_NAME[];
+
+typedef struct {
+  uint64_t ops[256];         // executions per opcode
+  uint64_t at[MEMORY_SIZE];  // executions per instruction offset
+  uint64_t sprite_ns;        // time spent drawing sprites
+  uint64_t clear_ns;         // time spent clearing
+} profile_t;
+
+/* TRACE */
+
+#define TRACE_RING (1 << 16) // records, a power of two
+#define TRACE_ALL 15         // load wrote all of x..f
+#define TRACE_MAGIC "BAYATRC1"
+
+// one record per executed instruction, pc:12 opcode:5 register:4 value:8,
+// register 0 meaning none was written, stored little endian after the magic
+#define TRACE_RECORD(pc, op, reg, value)                                       \
+  ((uint32_t)((pc) & 0xfff) | (uint32_t)((op) & 0x1f) << 12 |                  \
+   (uint32_t)((reg) & 0xf) << 17 | (uint32_t)((value) & 0xff) << 21)
+#define TRACE_PC(r) ((r) & 0xfff)
+#define TRACE_OP(r) (((r) >> 12) & 0x1f)
+#define TRACE_REG(r) (((r) >> 17) & 0xf)
+#define TRACE_VALUE(r) (((r) >> 21) & 0xff)
+
+// the vm thread is the only writer of head and a flusher thread the only
+// writer of tail, so neither needs a lock
+typedef struct {
+  uint32_t buf[TRACE_RING];
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  uint32_t tail_seen; // the writer's stale copy of tail
+  _Atomic bool stop;
+  FILE *file;
+  pthread_t flusher;
+} trace_t;
+
+static inline void push_trace(trace_t *t, uint32_t record) {
+  uint32_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+
+  // only look at the real tail when the stale one says the ring is full
+  while (head - t->tail_seen == TRACE_RING) {
+    t->tail_seen = atomic_load_explicit(&t->tail, memory_order_acquire);
+    if (head - t->tail_seen == TRACE_RING) sched_yield();
+  }
+  t->buf[head & (TRACE_RING - 1)] = record;
+  atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+/* PRINT */
+
+#define PRINT_RING (1 << 12) // records per channel, a power of two
+#define PRINT_MAGIC "BAYAPRT1"
+
+typedef enum { PRINT_LINES = 1, PRINT_JSON, PRINT_BINARY } print_format_t;
+
+typedef struct {
+  uint32_t id; // of the vm, or of the batch lane
+  uint32_t t;  // frames the channel had seen end
+  uint8_t reg;
+  uint8_t value;
+} print_record_t;
+
+typedef struct printer_t printer_t;
+
+// a channel is written by the thread running its vm or batch and read by
+// the printer's thread, and like trace_t needs no lock
+typedef struct print_t {
+  print_record_t buf[PRINT_RING];
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  uint32_t tail_seen;   // the writer's stale copy of tail
+  uint32_t id;          // what a vm's records get, a batch adds the lane
+  uint32_t t;           // run_frame and run_batch_frame count frames here
+  uint64_t left;        // records the cart may still print
+  uint64_t dropped;     // and the ones it printed past that
+  printer_t *printer;   // reading it
+  // until the printer makes room, through a pointer so a vm links without
+  // print.c
+  void (*wait)(struct print_t *c);
+  struct print_t *next; // in the printer's list
+} print_t;
+
+static inline void push_print(print_t *c, uint32_t id, uint8_t reg,
+                              uint8_t value) {
+  uint32_t head = atomic_load_explicit(&c->head, memory_order_relaxed);
+
+  if (c->left == 0) {
+    c->dropped++;
+    return;
+  }
+  c->left--;
+  while (head - c->tail_seen == PRINT_RING) {
+    c->tail_seen = atomic_load_explicit(&c->tail, memory_order_acquire);
+    if (head - c->tail_seen == PRINT_RING) c->wait(c);
+  }
+  c->buf[head & (PRINT_RING - 1)] = (print_record_t){id, c->t, reg, value};
+  atomic_store_explicit(&c->head, head + 1, memory_order_release);
+}
+
+typedef struct {
+  uint64_t instructions;
+  uint64_t sprites;
+} counts_t;
+
+typedef enum {
+  FAULT_PC = 1,          // ran or jumped past the last instruction
+  FAULT_OPCODE,          // not an instruction
+  FAULT_REGISTER,        // a register operand that isn't one
+  FAULT_OPERAND,         // an operator, comparison or key that isn't one
+  FAULT_ADDRESS,         // goto or point past the last 4 bytes
+  FAULT_STACK_OVERFLOW,  // save below stack_floor
+  FAULT_STACK_UNDERFLOW, // load with nothing saved
+  FAULT_DIVIDE,          // /= or %= by 0
+  FAULT_BUDGET,          // ran out of budget before the frame halted
+} fault_t;
+
+typedef struct vm_t vm_t;
+
+struct vm_t {
+  uint8_t mem[MEMORY_SIZE];
+  uint8_t regs[REGISTER_N];
+  uint16_t pc;
+  uint16_t sp;
+  uint16_t ip;  // index pointer
+  uint32_t rng; // xorshift32 state, never 0
+  uint8_t screen[SCREEN_HEIGHT][SCREEN_WIDTH]; // palette indices
+  uint8_t keys; // buttons held this frame, bit (key - 1) per keys_t
+  FILE *out;    // where print goes, nowhere when NULL
+  print_t *print;     // or records of it, to format on another thread
+  profile_t *profile; // run_frame uses exec_profiled when set
+  trace_t *trace;     // and exec_traced when this is
+  counts_t *counts;   // and exec_counted when this is
+  bool no_draw;       // and exec_undrawn, if none of those are, when this is
+  bool guarded;       // and exec_guarded before any of them, for strangers
+  uint32_t budget;    // instructions exec_budgeted may still run
+  uint16_t stack_floor; // save may not write below this, the cart's end
+  fault_t fault;        // what stopped a checked or budgeted run, 0 if nothing
+  // when set, exec stops on a trap and this takes the frame from there,
+  // returning true if the frame halted while it had it
+  bool (*trap)(vm_t *vm);
+};
+
+/* ENUMS */
+/* starting at 1, because 0 represents an invalid token */
+
+typedef enum { RX = 1, RY, RZ, RW, RA, RB, RC, RD, RE, RF, RT } reg_t;
+
+typedef enum { KACTION = 1, KUP, KDOWN, KLEFT, KRIGHT } keys_t;
+
+typedef enum {
+  HALT = 1,
+  SAVE,           // save
+  LOAD,           // load
+  GOTO,           // goto NNN
+  PRINT,          // print x
+  CLEAR,          // clear N
+  POINT,          // point NNN
+  SPRITE,         // sprite x y col
+  REG_OP_REG,     // x o= y
+  REG_SET_LIT,    // x = NN
+  REG_ADD_LIT,    // x += NN
+  REG_RANDOM,     // x = random NN
+  IF_REG_CMP_REG, // if x c y then
+  IF_REG_EQ_LIT,  // if x == NN then
+  IF_REG_NE_LIT,  // if x != NN then
+  IF_KEY,         // key K then
+  TRAP,           // breakpoint, only ever patched in by the debugger
+} ins_t;
+
+typedef enum {
+  SET = 1, // =
+  ADD,     // +=
+  SUB,     // -=
+  MUL,     // *=
+  DIV,     // /=
+  MOD,     // %=
+  AND,     // &=
+  OR,      // |=
+  XOR,     // ^=
+} op_t;
+
+typedef enum {
+  EQ = 1, // ==
+  NE,     // !=
+  LT,     // <
+  LE,     // <=
+  GT,     // >
+  GE,     // >=
+} cmp_t;
+
+/* READER */
+
+#define DIAG_MAX 16
+
+typedef enum { DIAG_ERROR = 1, DIAG_WARNING } diag_level_t;
+
+typedef struct {
+  diag_level_t level;
+  uint16_t line;
+  uint16_t column;          // of the token, from 1
+  const char *msg;          // static text
+  char token[TOKEN_LENGTH]; // at fault, empty at the end of the source
+} diag_t;
+
+typedef struct {
+  uint8_t image[MEMORY_SIZE]; // for init_vm
+  uint16_t size;              // bytes used, the final halt included
+  diag_t diags[DIAG_MAX];     // warnings, then the error if it failed
+  uint8_t diag_n;
+} cart_t;
+
+// diagnostics of the last assembly
+extern diag_t diag[DIAG_MAX];
+extern uint8_t diag_n;
+
+// assemble leaves the image in mem as read_file does, but returns false on
+// an error instead of exiting; baya_assemble puts the result in cart and
+// touches nothing else, so any number may run at once
+bool assemble(const char *src, size_t len);
+bool baya_assemble(const char *src, size_t len, cart_t *cart);
+void print_diags(FILE *f, const diag_t *d, uint8_t n);
+char *read_source(const char *name, size_t *len); // malloc'd, or NULL
+void read_file(char *name);
+int label_before(uint16_t at);
+
+/* LIBRARY */
+/* a header, an index sorted by name and then the assembled images, laid out */
+/* to be mapped and used as they are: whole images start on a page of their */
+/* own, so starting a cart touches the index and one page */
+
+#define LIBRARY_MAGIC "bayalib1"
+#define LIBRARY_NAME 40 // of a cart, the nul included
+#define LIBRARY_LZ4 1   // images are lz4 blocks of their used bytes instead
+
+typedef struct {
+  char magic[8];
+  uint32_t count;
+  uint32_t flags;
+} library_header_t;
+
+typedef struct {
+  char name[LIBRARY_NAME];
+  uint64_t hash;   // of the whole image
+  uint32_t offset; // of the image from the start of the file
+  uint16_t stored; // bytes there
+  uint16_t size;   // bytes the cart uses, as cart_t
+} library_entry_t;
+
+typedef struct library_t library_t;
+
+// carts and names go in any order, and names must be unique
+bool write_library(const char *path, const cart_t *carts,
+                   const char (*names)[LIBRARY_NAME], uint32_t n,
+                   uint32_t flags);
+library_t *open_library(const char *path);
+void close_library(library_t *lib);
+const library_entry_t *find_cart(const library_t *lib, const char *name);
+// the image in place, or unpacked into buf; NULL if it is damaged
+const uint8_t *cart_image(const library_t *lib, const library_entry_t *e,
+                          uint8_t buf[MEMORY_SIZE]);
+uint64_t hash_image(const uint8_t *image);
+size_t lz4_pack(const uint8_t *in, size_t n, uint8_t *out); // out of n+n/255+16
+bool lz4_unpack(const uint8_t *in, size_t n, uint8_t *out, size_t size);
+
+/* VM */
+
+void seed_random(vm_t *vm, uint32_t seed);
+uint32_t next_random(uint32_t *rng);
+uint8_t random_below(uint32_t *rng, uint8_t n); // uniform in 0..n-1
+void init_vm(vm_t *vm, const uint8_t *image);
+#define EXEC_PROFILE 1
+#define EXEC_TRACE 2
+#define EXEC_COUNT 4
+#define EXEC_STEP 8
+#define EXEC_BUDGET 16
+#define EXEC_CHECK 32 // built in with -DBAYA_CHECKED, always in exec_guarded
+#define EXEC_NO_DRAW 64
+
+extern const char *FAULT_NAME[];
+
+static inline bool valid_reg(uint8_t r) { return r >= RX && r <= RT; }
+
+static inline fault_t check_code(const uint8_t *p, bool trap) {
+  // everything the instruction at p reads or jumps to is in bounds, as far
+  // as the instruction alone can tell
+  uint16_t nnn = p[1] * 0x100 + p[2] * 0x10 + p[3];
+
+  switch (p[0]) {
+  case HALT:
+  case SAVE:
+  case LOAD:
+  case CLEAR:
+    return 0;
+  case GOTO:
+  case POINT:
+    return nnn > MEMORY_SIZE - 4 ? FAULT_ADDRESS : 0;
+  case PRINT:
+  case REG_SET_LIT:
+  case REG_ADD_LIT:
+  case REG_RANDOM:
+  case IF_REG_EQ_LIT:
+  case IF_REG_NE_LIT:
+    return valid_reg(p[1]) ? 0 : FAULT_REGISTER;
+  case SPRITE:
+    return valid_reg(p[1]) && valid_reg(p[2]) ? 0 : FAULT_REGISTER;
+  case REG_OP_REG:
+    if (p[1] < SET || p[1] > XOR) return FAULT_OPERAND;
+    return valid_reg(p[2]) && valid_reg(p[3]) ? 0 : FAULT_REGISTER;
+  case IF_REG_CMP_REG:
+    if (p[1] < EQ || p[1] > GE) return FAULT_OPERAND;
+    return valid_reg(p[2]) && valid_reg(p[3]) ? 0 : FAULT_REGISTER;
+  case IF_KEY:
+    return p[1] >= KACTION && p[1] <= KRIGHT ? 0 : FAULT_OPERAND;
+  case TRAP:
+    // a trap is only an instruction while a debugger is there for it
+    return trap ? 0 : FAULT_OPCODE;
+  default:
+    return FAULT_OPCODE;
+  }
+}
+
+uint64_t now_ns();
+// each returns true once the frame halted, false when a trap stopped it
+bool exec(vm_t *vm);
+bool exec_profiled(vm_t *vm);
+bool exec_traced(vm_t *vm);
+bool exec_counted(vm_t *vm);
+bool exec_step(vm_t *vm); // one instruction, traps included
+bool exec_budgeted(vm_t *vm); // a frame cut short faults with FAULT_BUDGET
+bool exec_undrawn(vm_t *vm); // sprite and clear leave the screen alone
+bool exec_guarded(vm_t *vm); // checked and budgeted, whatever the build
+void run_frame(vm_t *vm);
+
+/* SNAPSHOT */
+
+// mem, regs, pc, sp, ip, rng and screen, in that order, numbers little endian
+#define SNAPSHOT_SIZE                                                          \
+  (MEMORY_SIZE + REGISTER_N + 3 * 2 + 4 + SCREEN_WIDTH * SCREEN_HEIGHT)
+
+void baya_snapshot(const vm_t *vm, uint8_t *blob);
+void baya_restore(vm_t *vm, const uint8_t *blob);
+uint64_t baya_hash(const vm_t *vm); // of the snapshot, to compare states
+
+/* BATCH */
+
+#define BATCH_LANES 32 // instances stepped together, a bit each in a mask
+#define BATCH_PAGE 256 // bytes of memory a lane copies on first writing them
+#define BATCH_PAGES (MEMORY_SIZE / BATCH_PAGE)
+
+// BATCH_LANES instances of one cart, stored register by register, so the
+// lanes at the same pc run an instruction as a few vector operations; each
+// lane's memory is a table of pages, the cart's own until it writes to them
+typedef struct {
+  uint8_t regs[REGISTER_N][BATCH_LANES]; // regs[r - 1][lane]
+  uint8_t keys[BATCH_LANES];
+  uint16_t pc[BATCH_LANES];
+  uint16_t sp[BATCH_LANES];
+  uint16_t ip[BATCH_LANES];
+  uint32_t rng[BATCH_LANES];
+  fault_t fault[BATCH_LANES];
+  uint32_t on;       // lanes that hold an instance
+  uint32_t live;     // and are still running this frame
+  uint32_t own_code; // and have saved over the cart, so run on their own
+  uint32_t page[BATCH_LANES][BATCH_PAGES]; // into batch_t.pages
+  uint8_t screen[BATCH_LANES][SCREEN_HEIGHT][SCREEN_WIDTH];
+} __attribute__((aligned(64))) lane_block_t;
+
+typedef struct {
+  uint32_t n;      // instances
+  uint32_t blocks; // of BATCH_LANES, the last one maybe partly on
+  lane_block_t *block;
+  // the cart's image as the first BATCH_PAGES, then the lanes' copies
+  uint8_t (*pages)[BATCH_PAGE];
+  uint32_t page_n;
+  uint32_t page_cap;
+  uint32_t *spare; // copies no lane holds any more
+  uint32_t spare_n;
+  uint16_t size;   // of the cart's code, which save may not write below
+  FILE *out;       // where print goes, nowhere when NULL
+  print_t *print;  // or records of it, each lane's id offset by the lane
+  uint64_t issued; // instructions run, once per group of lanes
+  uint64_t lanes;  // and once per lane, so lanes / issued is the occupancy
+} batch_t;
+
+// every instance starts as init_vm would start it, but with out NULL;
+// run_batch_frame runs one frame on each like run_frame
+batch_t *open_batch(const uint8_t *image, uint16_t size, uint32_t n);
+void close_batch(batch_t *b);
+void seed_lane(batch_t *b, uint32_t lane, uint32_t seed);
+void set_lane_keys(batch_t *b, uint32_t lane, uint8_t keys);
+void get_lane(const batch_t *b, uint32_t lane, vm_t *vm);
+void put_lane(batch_t *b, uint32_t lane, const vm_t *vm);
+void run_batch_frame(batch_t *b);
+
+/* PRINTER */
+
+// limit is records per channel, 0 for none; close_printer writes out what
+// is left and frees every channel, so nothing may print to them after
+printer_t *open_printer(FILE *f, print_format_t format, uint64_t limit);
+print_t *open_print(printer_t *p, uint32_t id);
+void close_printer(printer_t *p);
+
+/* FARM */
+
+#define FARM_WORKERS_MAX 64
+
+typedef enum { TASK_BATCH, TASK_INTERACTIVE } priority_t;
+
+typedef enum {
+  TASK_QUEUED = 1,
+  TASK_RUNNING,
+  TASK_DONE,      // ran its frames, or stopped on a fault
+  TASK_CANCELLED, // stopped early by cancel_task
+} task_state_t;
+
+// run frames frames of vm headless, through run_frame, on whichever worker
+// gets there first; the vm is the task's alone until it is done
+typedef struct {
+  vm_t *vm;
+  uint32_t frames;
+  priority_t priority; // interactive tasks go ahead of every batch one
+  uint32_t ran;        // frames run so far
+  _Atomic bool cancel;
+  _Atomic task_state_t state;
+} task_t;
+
+typedef struct {
+  uint64_t wall_ns; // since the farm opened
+  uint64_t busy_ns; // of it spent running frames
+  uint64_t tasks;   // finished or cancelled while running
+  uint64_t frames;  // run, in whole tasks or not
+  uint64_t steals;  // tasks taken from another worker's deque
+} worker_stats_t;
+
+typedef struct farm_t farm_t;
+
+farm_t *open_farm(uint8_t workers); // 0 for one per core
+void submit_task(farm_t *f, task_t *t);
+void cancel_task(task_t *t);
+void wait_task(farm_t *f, task_t *t);
+void wait_farm(farm_t *f); // until every submitted task has ended
+uint8_t farm_workers(const farm_t *f);
+void get_worker_stats(farm_t *f, uint8_t worker, worker_stats_t *s);
+void report_farm(farm_t *f, FILE *out);
+void close_farm(farm_t *f);
+
+/* ENV */
+
+// what a step leaves behind; screen is the vm's own framebuffer, so it is
+// only good until the next step or reset of that environment
+typedef struct {
+  const uint8_t *screen; // SCREEN_HEIGHT rows of SCREEN_WIDTH palette indices
+  uint8_t reward;        // the reward register, 0 without one
+  bool done;             // the done register isn't 0, or the cart faulted
+  uint8_t t;
+} step_t;
+
+typedef struct {
+  vm_t vm;
+  uint8_t image[MEMORY_SIZE];
+  uint16_t size;  // of the cart's code, which save may not write below
+  uint8_t reward; // registers, 0 for none
+  uint8_t done;
+} env_t;
+
+// n environments of one cart side by side, each reset with its own seed;
+// action masks hold the buttons as vm_t.keys does
+env_t *open_env(const uint8_t *image, uint16_t size, reg_t reward, reg_t done,
+                uint32_t n);
+void close_env(env_t *e);
+step_t env_reset(env_t *e, uint32_t seed);
+step_t env_step(env_t *e, uint8_t action_mask);
+void env_step_many(env_t *e, uint32_t n, const uint8_t *action_masks,
+                   step_t *steps);
+
+/* REWIND */
+
+#define REWIND_SECONDS 60
+
+// deltas[i] turns the state recorded after it back into the one before it,
+// so stepping back from head only ever touches a few bytes
+typedef struct {
+  uint8_t head[SNAPSHOT_SIZE];
+  uint8_t **deltas;
+  uint16_t *delta_len;
+  uint16_t *delta_cap;
+  uint32_t frames; // capacity
+  uint32_t first;  // oldest delta
+  uint32_t n;      // deltas held
+  bool started;    // head holds a state
+} rewind_t;
+
+void init_rewind(rewind_t *rw, uint32_t seconds);
+void free_rewind(rewind_t *rw);
+void record_frame(rewind_t *rw, const vm_t *vm);
+bool rewind_frame(rewind_t *rw, vm_t *vm);
+size_t rewind_bytes(const rewind_t *rw);
+
+/* VIDEO */
+
+typedef enum {
+  VIDEO_Y4M = 1, // yuv4mpeg2, 4:4:4
+  VIDEO_RGB,     // raw rgb24 frames, no header
+  VIDEO_PNG,     // one indexed png per frame
+  VIDEO_GIF,     // animated, frames cropped to what changed
+} video_format_t;
+
+typedef struct video_t video_t;
+
+#define VIDEO_SCALE_MAX 64 // 4096 pixels wide
+
+// path is a file, "-" for stdout, or a directory for VIDEO_PNG
+video_t *open_video(video_format_t format, const char *path, uint8_t scale,
+                    uint8_t threads);
+void push_video(video_t *v, const uint8_t *screen);
+void close_video(video_t *v);
+
+/* TERMINAL */
+
+typedef struct term_t term_t;
+
+// draws screens with 24-bit colour escapes to fd, which should be a
+// terminal 64 columns wide and 16 rows high at least
+term_t *open_term(int fd);
+void draw_term(term_t *t, const uint8_t *screen);
+void close_term(term_t *t);
+
+/* BACKEND */
+
+// where frames go and buttons come from, chosen at startup with -backend
+typedef struct {
+  const char *name;
+  bool paced;     // held to FPS for someone watching, the rest run flat out
+  bool draws;     // the vm may leave the screen alone when this is false
+  bool on_stdout; // so print goes to stderr instead
+  void *(*open)(void); // NULL if it couldn't
+  uint8_t (*keys)(void *b); // buttons held now
+  bool (*present)(void *b, const uint8_t *screen); // false once closed
+  void (*close)(void *b);
+} backend_t;
+
+// what the soft backend's open returns, the last screen as pixels
+typedef struct {
+  uint8_t rgba[SCREEN_HEIGHT][SCREEN_WIDTH][4];
+  uint64_t frames;
+} soft_t;
+
+// the raylib window is main.c's, the only one needing a gpu
+extern const backend_t SOFT_BACKEND, TERM_BACKEND, NULL_BACKEND;
+
+/* DISASSEMBLER */
+
+const char *reg_name(uint8_t r);
+void disassemble(const uint8_t *ins, char *out, size_t n);
+
+/* TRACE */
+
+trace_t *open_trace(const char *path);
+void close_trace(trace_t *t);
+
+/* PROFILE */
+
+void write_profile(const profile_t *p, const char *cart, const char *prefix);
+
+/* TELEMETRY */
+
+#define HIST_BUCKETS 40
+
+typedef enum {
+  PHASE_EXEC,    // run_frame
+  PHASE_UPDATE,  // input, rewind, recording
+  PHASE_DRAW,    // building the frame
+  PHASE_PRESENT, // EndDrawing
+  PHASE_IDLE,    // waiting for the next frame
+  PHASE_N,
+} phase_t;
+
+extern const char *PHASE_NAME[];
+
+typedef struct {
+  uint64_t frames;
+  uint64_t last_ns[PHASE_N];
+  uint64_t total_ns[PHASE_N];
+  uint64_t max_ns[PHASE_N];
+  uint32_t hist[PHASE_N][HIST_BUCKETS];
+  uint64_t last_instructions, instructions;
+  uint64_t last_sprites, sprites;
+  FILE *csv;           // a row per frame, if set
+  const char *metrics; // rewritten every second, if set
+} telemetry_t;
+
+telemetry_t *open_telemetry(const char *csv, const char *metrics);
+void add_frame(telemetry_t *t, const uint64_t ns[PHASE_N],
+               uint64_t instructions, uint64_t sprites);
+uint64_t phase_percentile(const telemetry_t *t, phase_t p, double q);
+void close_telemetry(telemetry_t *t);
+
+/* SERVER */
+
+#define SERVE_HEADER 8         // op:1 flags:1 frames:2 len:4, little endian
+#define SERVE_FRAMES_MAX 1024  // frames one step may ask for
+#define SERVE_MESSAGE_MAX (1 << 20)
+
+// every message is a header and then len bytes; a request is answered with
+// one SERVE_OK or SERVE_ERROR, in order
+typedef enum {
+  SERVE_LOAD = 1, // seed:4 and an image, the code first
+  SERVE_ASSEMBLE, // seed:4 and the source of a cart
+  SERVE_STEP,     // a byte of buttons for each frame to run
+  SERVE_OK,       // after a step, frames run and the fault that stopped it
+  SERVE_ERROR,    // the reason as text, diagnostics for SERVE_ASSEMBLE
+} serve_op_t;
+
+// what a step replies with for each frame run, in this order
+#define SERVE_HASH 1   // baya_hash:8
+#define SERVE_SCREEN 2 // the screen, SCREEN_HEIGHT rows of SCREEN_WIDTH
+
+// serves sessions on a unix socket at path until killed, each with its own
+// vm, with threads threads between them
+int serve(const char *path, uint8_t threads);
+
+/* DEBUGGER */
+
+void attach_debugger(vm_t *vm);
+
+#endif
@@ -0,0 +1,3 @@
+#!/bin/sh
+
+cc -O2 tools/bench.c baya.c batch.c farm.c print.c -lm -lpthread -o bench && ./bench "$@" && rm ./bench
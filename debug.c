@@ -0,0 +1,345 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "baya.h"
+
+/* DEBUGGER */
+/* a breakpoint swaps its opcode in mem for TRAP, so exec runs at full */
+/* speed until one is hit; watchpoints single-step and compare registers. */
+/* a save over a trap goes unseen until the debugger next stops, and a */
+/* breakpoint there is missed until then */
+
+#define BREAK_MAX 64
+#define ENTRY 0 // where every frame starts
+
+typedef struct {
+  uint16_t at;
+  uint8_t op; // the opcode the trap replaced
+  bool user;  // false for the debugger's own trap at the frame entry
+} break_t;
+
+typedef enum { RUN_HALTED, RUN_EXEC, RUN_WATCHED } run_t;
+
+static break_t breaks[BREAK_MAX];
+static uint8_t break_n;
+static uint16_t watch;              // watched registers, bit r - 1
+static uint8_t watched[REGISTER_N]; // their values when last looked at
+static bool stop_at_entry;          // stop as the next frame starts
+static char last[128];              // an empty line repeats this
+
+static const char REG_LETTER[] = "?xyzwabcdeft";
+
+static int find_break(uint16_t at) {
+  for (uint8_t i = 0; i < break_n; i++)
+    if (breaks[i].at == at) return i;
+  return -1;
+}
+
+static bool add_break(vm_t *vm, uint16_t at, bool user) {
+  int i = find_break(at);
+
+  if (i >= 0) {
+    breaks[i].user |= user;
+    return true;
+  }
+  if (break_n == BREAK_MAX) return false;
+
+  breaks[break_n++] = (break_t){at, vm->mem[at], user};
+  vm->mem[at] = TRAP;
+  return true;
+}
+
+static void remove_break(vm_t *vm, int i) {
+  vm->mem[breaks[i].at] = breaks[i].op;
+  breaks[i] = breaks[--break_n];
+}
+
+static void rearm_breaks(vm_t *vm) {
+  // the cart saved over these traps, so what it wrote is what to restore
+  for (uint8_t i = 0; i < break_n; i++)
+    if (vm->mem[breaks[i].at] != TRAP) {
+      breaks[i].op = vm->mem[breaks[i].at];
+      vm->mem[breaks[i].at] = TRAP;
+    }
+}
+
+static void sync_entry(vm_t *vm) {
+  // the entry trap hands every frame to the debugger while it needs them
+  int i = find_break(ENTRY);
+
+  if (stop_at_entry || watch)
+    add_break(vm, ENTRY, false);
+  else if (i >= 0 && !breaks[i].user)
+    remove_break(vm, i);
+}
+
+static bool step_one(vm_t *vm) {
+  // runs the instruction at pc as if no breakpoint were on it
+  uint16_t at = vm->pc;
+  int i = find_break(at);
+  bool halted;
+
+  if (i >= 0) vm->mem[at] = breaks[i].op;
+  halted = exec_step(vm);
+  if (i >= 0) {
+    // save may have written over it
+    breaks[i].op = vm->mem[at];
+    vm->mem[at] = TRAP;
+  }
+  return halted;
+}
+
+static uint8_t watch_hit(vm_t *vm) {
+  // the first watched register that changed, or 0
+  for (uint8_t r = 1; r < REGISTER_N; r++)
+    if (watch & 1 << (r - 1) && vm->regs[r - 1] != watched[r - 1]) {
+      fprintf(stderr, "%s changed %u -> %u\n", reg_name(r), watched[r - 1],
+              vm->regs[r - 1]);
+      memcpy(watched, vm->regs, REGISTER_N);
+      return r;
+    }
+  return 0;
+}
+
+static run_t run_on(vm_t *vm) {
+  // steps off the stop, then leaves the rest to exec unless watching
+  do {
+    if (step_one(vm)) return RUN_HALTED;
+    if (!watch) return RUN_EXEC;
+    if (watch_hit(vm)) return RUN_WATCHED;
+  } while (vm->mem[vm->pc] != TRAP);
+  return RUN_EXEC;
+}
+
+/* INSPECTION */
+
+static void show_where(const vm_t *vm) {
+  uint8_t ins[4];
+  char text[64];
+  int i, l;
+
+  for (uint8_t k = 0; k < 4; k++)
+    ins[k] = vm->mem[(vm->pc + k) & (MEMORY_SIZE - 1)];
+  if ((i = find_break(vm->pc)) >= 0) ins[0] = breaks[i].op;
+  disassemble(ins, text, sizeof(text));
+
+  l = label_before(vm->pc);
+  fprintf(stderr, "0x%03x line %u %s  %s\n", vm->pc, line_at[vm->pc],
+          l >= 0 ? label[l] : "-", text);
+}
+
+static void show_regs(const vm_t *vm) {
+  for (uint8_t r = 1; r < REGISTER_N; r++)
+    fprintf(stderr, "%s = %u%s", reg_name(r), vm->regs[r - 1],
+            r % 6 == 0 || r == REGISTER_N - 1 ? "\n" : "  ");
+  fprintf(stderr, "pc = 0x%03x  sp = 0x%03x  ip = 0x%03x\n", vm->pc, vm->sp,
+          vm->ip);
+}
+
+static void show_mem(const vm_t *vm, uint16_t at, uint16_t n) {
+  // what the cart sees, traps shown as the opcodes they replaced
+  int i;
+
+  for (uint16_t k = 0; k < n && at + k < MEMORY_SIZE; k++) {
+    if (k % 16 == 0) fprintf(stderr, "%s0x%03x ", k ? "\n" : "", at + k);
+    i = find_break(at + k);
+    fprintf(stderr, " %02x", i >= 0 ? breaks[i].op : vm->mem[at + k]);
+  }
+  fputc('\n', stderr);
+}
+
+static void show_breaks() {
+  for (uint8_t i = 0; i < break_n; i++)
+    if (breaks[i].user) {
+      int l = label_before(breaks[i].at);
+      fprintf(stderr, "break 0x%03x line %u %s\n", breaks[i].at,
+              line_at[breaks[i].at], l >= 0 ? label[l] : "-");
+    }
+  for (uint8_t r = 1; r < REGISTER_N; r++)
+    if (watch & 1 << (r - 1)) fprintf(stderr, "watch %s\n", reg_name(r));
+}
+
+/* COMMANDS */
+
+static bool parse_target(const char *arg, uint16_t *at, bool lines) {
+  // a label, an address, or with lines a decimal number is a source line
+  unsigned long n;
+  char *end;
+
+  for (uint8_t i = 0; i < label_n; i++)
+    if (label_defined[i] && strcmp(arg, label[i]) == 0) {
+      *at = label_offset[i];
+      return true;
+    }
+
+  n = strtoul(arg, &end, 0);
+  if (end == arg || *end) return false;
+  if (!lines || (arg[0] == '0' && (arg[1] == 'x' || arg[1] == 'X'))) {
+    *at = n;
+    return n < MEMORY_SIZE;
+  }
+
+  for (uint16_t i = 0; i < pc; i++)
+    if (line_at[i] == n) {
+      *at = i;
+      return true;
+    }
+  return false;
+}
+
+static uint8_t parse_reg(const char *arg) {
+  for (uint8_t r = 1; r < REGISTER_N; r++)
+    if (strcmp(arg, reg_name(r)) == 0 ||
+        (arg[0] == REG_LETTER[r] && arg[1] == '\0'))
+      return r;
+  return 0;
+}
+
+static bool is(const char *cmd, const char *shortcut, const char *name) {
+  return strcmp(cmd, shortcut) == 0 || strcmp(cmd, name) == 0;
+}
+
+static void help() {
+  fprintf(stderr,
+          "s, step [N]        run N instructions\n"
+          "c, continue        run to a breakpoint or watched change\n"
+          "b, break TARGET    at a label, 0x address or source line\n"
+          "d, delete TARGET\n"
+          "w, watch REG       stop when it changes\n"
+          "u, unwatch REG\n"
+          "r, regs            show registers\n"
+          "m, mem [ADDR [N]]  show N bytes of memory, from ip by default\n"
+          "l, list            show breakpoints and watches\n"
+          "q, quit\n");
+}
+
+static void detach(vm_t *vm) {
+  while (break_n) remove_break(vm, 0);
+  watch = 0;
+  stop_at_entry = false;
+  vm->trap = NULL;
+}
+
+static bool prompt(vm_t *vm) {
+  // reads commands until one runs the cart on, true if the frame halted
+  char line[128];
+  char *cmd, *arg, *arg2;
+  uint16_t at;
+  uint8_t r;
+  long n;
+  int i;
+
+  for (;;) {
+    fprintf(stderr, "(baya) ");
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+      // without a terminal the cart just runs on
+      fputc('\n', stderr);
+      detach(vm);
+      return false;
+    }
+    if (strspn(line, " \t\n") == strlen(line))
+      strcpy(line, last);
+    else
+      strcpy(last, line);
+
+    if ((cmd = strtok(line, " \t\n")) == NULL) continue;
+    arg = strtok(NULL, " \t\n");
+    arg2 = strtok(NULL, " \t\n");
+
+    if (is(cmd, "s", "step")) {
+      n = arg ? strtol(arg, NULL, 0) : 1;
+      for (; n > 0; n--)
+        if (step_one(vm)) {
+          fprintf(stderr, "frame halted\n");
+          stop_at_entry = true;
+          sync_entry(vm);
+          return true;
+        }
+      show_where(vm);
+    } else if (is(cmd, "c", "continue")) {
+      memcpy(watched, vm->regs, REGISTER_N);
+      switch (run_on(vm)) {
+      case RUN_HALTED:
+        return true;
+      case RUN_EXEC:
+        return false;
+      case RUN_WATCHED:
+        show_where(vm);
+        break;
+      }
+    } else if (is(cmd, "b", "break")) {
+      if (!arg || !parse_target(arg, &at, true))
+        fprintf(stderr, "no such label, address or line\n");
+      else if (!add_break(vm, at, true))
+        fprintf(stderr, "too many breakpoints\n");
+      else
+        fprintf(stderr, "break 0x%03x line %u\n", at, line_at[at]);
+    } else if (is(cmd, "d", "delete")) {
+      if (!arg || !parse_target(arg, &at, true) || (i = find_break(at)) < 0 ||
+          !breaks[i].user)
+        fprintf(stderr, "no breakpoint there\n");
+      else {
+        remove_break(vm, i);
+        sync_entry(vm);
+      }
+    } else if (is(cmd, "w", "watch") || is(cmd, "u", "unwatch")) {
+      if (!arg || !(r = parse_reg(arg))) {
+        fprintf(stderr, "no such register\n");
+        continue;
+      }
+      memcpy(watched, vm->regs, REGISTER_N);
+      if (cmd[0] == 'w')
+        watch |= 1 << (r - 1);
+      else
+        watch &= ~(1 << (r - 1));
+      sync_entry(vm);
+    } else if (is(cmd, "r", "regs"))
+      show_regs(vm);
+    else if (is(cmd, "m", "mem")) {
+      if (!arg || !parse_target(arg, &at, false)) at = vm->ip;
+      show_mem(vm, at, arg2 ? strtoul(arg2, NULL, 0) : 64);
+    } else if (is(cmd, "l", "list"))
+      show_breaks();
+    else if (is(cmd, "q", "quit"))
+      exit(0);
+    else
+      help();
+  }
+}
+
+static bool debug_trap(vm_t *vm) {
+  int i = find_break(vm->pc);
+
+  rearm_breaks(vm);
+  // a trap byte of the cart's own runs as the no-op it is
+  if (i < 0) return step_one(vm);
+
+  if (breaks[i].user) {
+    fprintf(stderr, "breakpoint at ");
+  } else if (stop_at_entry) {
+    stop_at_entry = false;
+    sync_entry(vm);
+    fprintf(stderr, "frame %u at ", vm->regs[RT - 1]);
+  } else {
+    // only here to keep watching through a new frame
+    switch (run_on(vm)) {
+    case RUN_HALTED:
+      return true;
+    case RUN_EXEC:
+      return false;
+    case RUN_WATCHED:
+      break;
+    }
+  }
+
+  show_where(vm);
+  return prompt(vm);
+}
+
+void attach_debugger(vm_t *vm) {
+  // stops before the first instruction
+  vm->trap = debug_trap;
+  stop_at_entry = true;
+  sync_entry(vm);
+  fprintf(stderr, "type help for commands\n");
+}
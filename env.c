@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "baya.h"
+
+/* ENV */
+/* a step is one run_frame with the action held, so an environment is only */
+/* a vm and the image to start it from again */
+
+env_t *open_env(const uint8_t *image, uint16_t size, reg_t reward, reg_t done,
+                uint32_t n) {
+  env_t *e = calloc(n, sizeof(env_t));
+
+  for (uint32_t i = 0; i < n; i++) {
+    memcpy(e[i].image, image, MEMORY_SIZE);
+    e[i].size = size;
+    e[i].reward = reward;
+    e[i].done = done;
+    env_reset(&e[i], i + 1);
+  }
+  return e;
+}
+
+void close_env(env_t *e) { free(e); }
+
+static step_t observe(const env_t *e) {
+  step_t s;
+
+  s.screen = &e->vm.screen[0][0];
+  s.reward = e->reward ? e->vm.regs[e->reward - 1] : 0;
+  s.done = (e->done && e->vm.regs[e->done - 1]) || e->vm.fault;
+  s.t = e->vm.regs[RT - 1];
+  return s;
+}
+
+step_t env_reset(env_t *e, uint32_t seed) {
+  init_vm(&e->vm, e->image);
+  seed_random(&e->vm, seed);
+  e->vm.out = NULL;
+  e->vm.stack_floor = e->size;
+  return observe(e);
+}
+
+step_t env_step(env_t *e, uint8_t action_mask) {
+  // an episode that ended stays ended until env_reset
+  step_t s = observe(e);
+
+  if (s.done) return s;
+  e->vm.keys = action_mask;
+  run_frame(&e->vm);
+  return observe(e);
+}
+
+void env_step_many(env_t *e, uint32_t n, const uint8_t *action_masks,
+                   step_t *steps) {
+  for (uint32_t i = 0; i < n; i++) steps[i] = env_step(&e[i], action_masks[i]);
+}
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "baya.h"
+
+#define FARM_DEQUE 64 // starting capacity, a power of two
+
+/* DEQUE */
+/* each worker pops its own work from the bottom and others steal from the */
+/* top, so a lock is only ever fought over by a thief and its victim */
+
+typedef struct {
+  pthread_mutex_t lock;
+  task_t **buf;
+  uint32_t cap;
+  uint32_t top;    // oldest task
+  uint32_t bottom; // one past the newest
+} deque_t;
+
+static void init_deque(deque_t *d) {
+  pthread_mutex_init(&d->lock, NULL);
+  d->cap = FARM_DEQUE;
+  d->buf = malloc(d->cap * sizeof(task_t *));
+  d->top = d->bottom = 0;
+}
+
+static void free_deque(deque_t *d) {
+  pthread_mutex_destroy(&d->lock);
+  free(d->buf);
+}
+
+static void push_bottom(deque_t *d, task_t *t) {
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom - d->top == d->cap) {
+    // unwrap into twice the room
+    task_t **buf = malloc(2 * d->cap * sizeof(task_t *));
+    for (uint32_t i = d->top; i != d->bottom; i++)
+      buf[i - d->top] = d->buf[i & (d->cap - 1)];
+    free(d->buf);
+    d->buf = buf;
+    d->bottom -= d->top;
+    d->top = 0;
+    d->cap *= 2;
+  }
+  d->buf[d->bottom++ & (d->cap - 1)] = t;
+  pthread_mutex_unlock(&d->lock);
+}
+
+static task_t *pop_bottom(deque_t *d) {
+  task_t *t = NULL;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom != d->top) t = d->buf[--d->bottom & (d->cap - 1)];
+  pthread_mutex_unlock(&d->lock);
+  return t;
+}
+
+static task_t *pop_top(deque_t *d) {
+  task_t *t = NULL;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom != d->top) t = d->buf[d->top++ & (d->cap - 1)];
+  pthread_mutex_unlock(&d->lock);
+  return t;
+}
+
+/* FARM */
+
+typedef struct {
+  farm_t *farm;
+  uint8_t id;
+  uint32_t rng; // picks where to start looking for a victim
+  deque_t deque;
+  pthread_t thread;
+  _Atomic uint64_t busy_ns;
+  _Atomic uint64_t tasks;
+  _Atomic uint64_t frames;
+  _Atomic uint64_t steals;
+} worker_t;
+
+struct farm_t {
+  worker_t worker[FARM_WORKERS_MAX];
+  uint8_t workers;
+  deque_t urgent;          // interactive tasks, first in first out
+  _Atomic uint32_t hurry;  // tasks in urgent, so running ones can yield
+  _Atomic uint32_t queued; // tasks in any deque
+  _Atomic uint32_t next;   // the worker the next batch task goes to
+  uint32_t unfinished;     // submitted and not yet done or cancelled
+  bool stop;
+  uint64_t started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;     // idle workers wait for tasks
+  pthread_cond_t finished; // wait_task and wait_farm wait for tasks to end
+};
+
+static task_t *take(farm_t *f, worker_t *w) {
+  task_t *t = NULL;
+
+  if (atomic_load_explicit(&f->hurry, memory_order_relaxed) &&
+      (t = pop_top(&f->urgent)))
+    atomic_fetch_sub(&f->hurry, 1);
+  else if ((t = pop_bottom(&w->deque)) == NULL) {
+    // every other worker once, starting somewhere random so thieves spread
+    uint8_t start = next_random(&w->rng) % f->workers;
+
+    for (uint8_t i = 0; i < f->workers && t == NULL; i++) {
+      worker_t *v = &f->worker[(start + i) % f->workers];
+      if (v != w && (t = pop_top(&v->deque)))
+        atomic_fetch_add_explicit(&w->steals, 1, memory_order_relaxed);
+    }
+  }
+
+  if (t) atomic_fetch_sub(&f->queued, 1);
+  return t;
+}
+
+static void end_task(farm_t *f, task_t *t, task_state_t state) {
+  pthread_mutex_lock(&f->lock);
+  atomic_store(&t->state, state);
+  f->unfinished--;
+  pthread_cond_broadcast(&f->finished);
+  pthread_mutex_unlock(&f->lock);
+}
+
+static void run_task(farm_t *f, worker_t *w, task_t *t) {
+  uint64_t t0 = now_ns();
+  uint32_t frames = 0;
+
+  atomic_store(&t->state, TASK_RUNNING);
+  while (t->ran < t->frames && !t->vm->fault) {
+    if (atomic_load_explicit(&t->cancel, memory_order_relaxed)) break;
+
+    // a batch task steps aside between frames for an interactive one, and
+    // picks up where it was from the bottom of this worker's deque
+    if (t->priority == TASK_BATCH &&
+        atomic_load_explicit(&f->hurry, memory_order_relaxed)) {
+      atomic_store(&t->state, TASK_QUEUED);
+      atomic_fetch_add(&f->queued, 1);
+      push_bottom(&w->deque, t);
+      t = NULL;
+      break;
+    }
+
+    run_frame(t->vm);
+    t->ran++;
+    frames++;
+  }
+
+  atomic_fetch_add_explicit(&w->busy_ns, now_ns() - t0, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->frames, frames, memory_order_relaxed);
+  if (t == NULL) return;
+
+  atomic_fetch_add_explicit(&w->tasks, 1, memory_order_relaxed);
+  end_task(f, t, atomic_load(&t->cancel) ? TASK_CANCELLED : TASK_DONE);
+}
+
+static void *farm_worker(void *arg) {
+  worker_t *w = arg;
+  farm_t *f = w->farm;
+  task_t *t;
+
+  for (;;) {
+    if ((t = take(f, w))) {
+      if (atomic_load(&t->cancel))
+        end_task(f, t, TASK_CANCELLED);
+      else
+        run_task(f, w, t);
+      continue;
+    }
+
+    // queued is raised before the submitter takes the lock to signal, so
+    // checking it under the lock can't miss a wakeup
+    pthread_mutex_lock(&f->lock);
+    while (atomic_load(&f->queued) == 0 && !f->stop)
+      pthread_cond_wait(&f->wake, &f->lock);
+    if (atomic_load(&f->queued) == 0 && f->stop) {
+      pthread_mutex_unlock(&f->lock);
+      break;
+    }
+    pthread_mutex_unlock(&f->lock);
+  }
+  return NULL;
+}
+
+farm_t *open_farm(uint8_t workers) {
+  farm_t *f = calloc(1, sizeof(farm_t));
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (workers == 0) workers = cores < 1 ? 1 : cores;
+  f->workers = workers > FARM_WORKERS_MAX ? FARM_WORKERS_MAX : workers;
+  f->started = now_ns();
+
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_cond_init(&f->wake, NULL);
+  pthread_cond_init(&f->finished, NULL);
+  init_deque(&f->urgent);
+
+  for (uint8_t i = 0; i < f->workers; i++) {
+    worker_t *w = &f->worker[i];
+    w->farm = f;
+    w->id = i;
+    w->rng = RANDOM_SEED + i;
+    init_deque(&w->deque);
+  }
+  for (uint8_t i = 0; i < f->workers; i++)
+    pthread_create(&f->worker[i].thread, NULL, farm_worker, &f->worker[i]);
+  return f;
+}
+
+void submit_task(farm_t *f, task_t *t) {
+  t->ran = 0;
+  atomic_store(&t->cancel, false);
+  atomic_store(&t->state, TASK_QUEUED);
+
+  pthread_mutex_lock(&f->lock);
+  f->unfinished++;
+  pthread_mutex_unlock(&f->lock);
+
+  // counted before they're pushed, so a count never drops below zero;
+  // batch tasks are dealt round the workers and rebalanced by stealing
+  atomic_fetch_add(&f->queued, 1);
+  if (t->priority == TASK_INTERACTIVE) {
+    atomic_fetch_add(&f->hurry, 1);
+    push_bottom(&f->urgent, t);
+  } else
+    push_bottom(&f->worker[atomic_fetch_add(&f->next, 1) % f->workers].deque,
+                t);
+
+  pthread_mutex_lock(&f->lock);
+  pthread_cond_signal(&f->wake);
+  pthread_mutex_unlock(&f->lock);
+}
+
+void cancel_task(task_t *t) { atomic_store(&t->cancel, true); }
+
+void wait_task(farm_t *f, task_t *t) {
+  pthread_mutex_lock(&f->lock);
+  while (atomic_load(&t->state) < TASK_DONE)
+    pthread_cond_wait(&f->finished, &f->lock);
+  pthread_mutex_unlock(&f->lock);
+}
+
+void wait_farm(farm_t *f) {
+  pthread_mutex_lock(&f->lock);
+  while (f->unfinished) pthread_cond_wait(&f->finished, &f->lock);
+  pthread_mutex_unlock(&f->lock);
+}
+
+uint8_t farm_workers(const farm_t *f) { return f->workers; }
+
+void get_worker_stats(farm_t *f, uint8_t worker, worker_stats_t *s) {
+  worker_t *w = &f->worker[worker];
+
+  s->wall_ns = now_ns() - f->started;
+  s->busy_ns = atomic_load_explicit(&w->busy_ns, memory_order_relaxed);
+  s->tasks = atomic_load_explicit(&w->tasks, memory_order_relaxed);
+  s->frames = atomic_load_explicit(&w->frames, memory_order_relaxed);
+  s->steals = atomic_load_explicit(&w->steals, memory_order_relaxed);
+}
+
+void report_farm(farm_t *f, FILE *out) {
+  worker_stats_t s;
+
+  fprintf(out, "worker   util     tasks      frames    steals\n");
+  for (uint8_t i = 0; i < f->workers; i++) {
+    get_worker_stats(f, i, &s);
+    fprintf(out, "%6u %5.1f%% %9llu %11llu %9llu\n", i,
+            s.wall_ns ? 100.0 * s.busy_ns / s.wall_ns : 0.0,
+            (unsigned long long)s.tasks, (unsigned long long)s.frames,
+            (unsigned long long)s.steals);
+  }
+}
+
+void close_farm(farm_t *f) {
+  pthread_mutex_lock(&f->lock);
+  f->stop = true;
+  pthread_cond_broadcast(&f->wake);
+  pthread_mutex_unlock(&f->lock);
+
+  // any of them may still be looking in another's deque until all are gone
+  for (uint8_t i = 0; i < f->workers; i++)
+    pthread_join(f->worker[i].thread, NULL);
+  for (uint8_t i = 0; i < f->workers; i++) free_deque(&f->worker[i].deque);
+  free_deque(&f->urgent);
+  pthread_mutex_destroy(&f->lock);
+  pthread_cond_destroy(&f->wake);
+  pthread_cond_destroy(&f->finished);
+  free(f);
+}
@@ -0,0 +1,264 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "baya.h"
+
+#define LZ4_HASH 12         // bits of the match finder's table
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the format ends every block on these
+#define LZ4_MATCH_LIMIT 12  // no match starts closer to the end than this
+
+/* LZ4 */
+/* the block format: a token with the literal and match lengths, the */
+/* literals, then a 2 byte offset back to the match; longer lengths go on in */
+/* bytes of 255 */
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint32_t hash4(const uint8_t *p) {
+  return read32(p) * 2654435761u >> (32 - LZ4_HASH);
+}
+
+static uint8_t *put_length(uint8_t *out, size_t n) {
+  for (; n >= 255; n -= 255) *out++ = 255;
+  *out++ = n;
+  return out;
+}
+
+static uint8_t *put_literals(uint8_t *out, uint8_t *token, const uint8_t *p,
+                             size_t n) {
+  *token = (n < 15 ? n : 15) << 4;
+  if (n >= 15) out = put_length(out, n - 15);
+  memcpy(out, p, n);
+  return out + n;
+}
+
+size_t lz4_pack(const uint8_t *in, size_t n, uint8_t *out) {
+  // greedy, with the last place each 4 bytes were seen; carts are small
+  // enough that every offset fits
+  uint32_t seen[1 << LZ4_HASH] = {0}; // positions, plus one
+  uint8_t *o = out, *token;
+  size_t i = 0, anchor = 0, ref, len;
+  uint32_t h;
+
+  while (n > LZ4_MATCH_LIMIT && i < n - LZ4_MATCH_LIMIT) {
+    h = hash4(in + i);
+    ref = seen[h];
+    seen[h] = i + 1;
+    if (ref == 0 || i - --ref > 0xffff || read32(in + ref) != read32(in + i)) {
+      i++;
+      continue;
+    }
+
+    len = LZ4_MIN_MATCH;
+    while (i + len < n - LZ4_LAST_LITERALS && in[ref + len] == in[i + len])
+      len++;
+
+    token = o++;
+    o = put_literals(o, token, in + anchor, i - anchor);
+    *o++ = (i - ref) & 0xff;
+    *o++ = (i - ref) >> 8;
+    *token |= len - LZ4_MIN_MATCH < 15 ? len - LZ4_MIN_MATCH : 15;
+    if (len - LZ4_MIN_MATCH >= 15) o = put_length(o, len - LZ4_MIN_MATCH - 15);
+    i += len;
+    anchor = i;
+  }
+
+  token = o++;
+  o = put_literals(o, token, in + anchor, n - anchor);
+  return o - out;
+}
+
+static bool get_length(const uint8_t **in, const uint8_t *end, size_t *n) {
+  uint8_t b;
+
+  if (*n != 15) return true;
+  do {
+    if (*in == end) return false;
+    *n += b = *(*in)++;
+  } while (b == 255);
+  return true;
+}
+
+bool lz4_unpack(const uint8_t *in, size_t n, uint8_t *out, size_t size) {
+  // false unless in is one whole block of exactly size bytes
+  const uint8_t *end = in + n;
+  size_t o = 0, len, off;
+  uint8_t token;
+
+  while (in < end) {
+    token = *in++;
+    len = token >> 4;
+    if (!get_length(&in, end, &len) || len > (size_t)(end - in) ||
+        len > size - o)
+      return false;
+    memcpy(out + o, in, len);
+    in += len;
+    o += len;
+    if (in == end) break; // the last sequence has no match
+
+    if (end - in < 2) return false;
+    off = in[0] | in[1] << 8;
+    in += 2;
+    len = token & 15;
+    if (off == 0 || off > o || !get_length(&in, end, &len) ||
+        (len += LZ4_MIN_MATCH) > size - o)
+      return false;
+    // byte by byte, since a match may overlap what it copies
+    for (; len; len--, o++) out[o] = out[o - off];
+  }
+  return o == size;
+}
+
+/* WRITER */
+
+uint64_t hash_image(const uint8_t *image) {
+  // fnv-1a, mixed at the end as baya_hash is
+  uint64_t h = 0xcbf29ce484222325ull;
+
+  for (size_t i = 0; i < MEMORY_SIZE; i++)
+    h = (h ^ image[i]) * 0x100000001b3ull;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+static int by_name(const void *a, const void *b) {
+  return strncmp(((const library_entry_t *)a)->name,
+                 ((const library_entry_t *)b)->name, LIBRARY_NAME);
+}
+
+bool write_library(const char *path, const cart_t *carts,
+                   const char (*names)[LIBRARY_NAME], uint32_t n,
+                   uint32_t flags) {
+  library_header_t h = {LIBRARY_MAGIC, n, flags};
+  library_entry_t *index = calloc(n, sizeof(library_entry_t));
+  uint8_t packed[MEMORY_SIZE + MEMORY_SIZE / 255 + 16];
+  const uint8_t *data;
+  uint32_t at = sizeof(h) + n * sizeof(library_entry_t);
+  FILE *f = fopen(path, "wb");
+  bool ok;
+
+  if (f == NULL) {
+    free(index);
+    return false;
+  }
+
+  // offset holds which cart an entry is until the images are placed
+  for (uint32_t i = 0; i < n; i++) {
+    memcpy(index[i].name, names[i], LIBRARY_NAME);
+    index[i].name[LIBRARY_NAME - 1] = '\0';
+    index[i].hash = hash_image(carts[i].image);
+    index[i].offset = i;
+    index[i].size = carts[i].size;
+  }
+  qsort(index, n, sizeof(library_entry_t), by_name);
+
+  // images go after the index, whole ones each on a page of their own and
+  // packed ones end to end
+  for (uint32_t i = 0; i < n; i++) {
+    data = carts[index[i].offset].image;
+    if (flags & LIBRARY_LZ4) {
+      index[i].stored = lz4_pack(data, index[i].size, packed);
+      data = packed;
+    } else {
+      at = (at + MEMORY_SIZE - 1) & ~(MEMORY_SIZE - 1);
+      index[i].stored = MEMORY_SIZE;
+    }
+    index[i].offset = at;
+    fseek(f, at, SEEK_SET);
+    fwrite(data, 1, index[i].stored, f);
+    at += index[i].stored;
+  }
+
+  fseek(f, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(index, sizeof(library_entry_t), n, f);
+  ok = !ferror(f);
+  ok &= fclose(f) == 0;
+  free(index);
+  return ok;
+}
+
+/* READER */
+
+struct library_t {
+  const uint8_t *data;
+  size_t len;
+  const library_header_t *header;
+  const library_entry_t *index;
+};
+
+library_t *open_library(const char *path) {
+  // only the header is checked, entries when their cart is asked for
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  library_t *lib;
+  void *data;
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(library_header_t) ||
+      (data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+          MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  lib = malloc(sizeof(library_t));
+  lib->data = data;
+  lib->len = st.st_size;
+  lib->header = data;
+  lib->index = (const library_entry_t *)(lib->header + 1);
+  if (memcmp(lib->header->magic, LIBRARY_MAGIC, sizeof(lib->header->magic)) ||
+      lib->header->count >
+          (lib->len - sizeof(library_header_t)) / sizeof(library_entry_t)) {
+    close_library(lib);
+    return NULL;
+  }
+  return lib;
+}
+
+void close_library(library_t *lib) {
+  munmap((void *)lib->data, lib->len);
+  free(lib);
+}
+
+const library_entry_t *find_cart(const library_t *lib, const char *name) {
+  uint32_t lo = 0, hi = lib->header->count, mid;
+  int c;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    c = strncmp(name, lib->index[mid].name, LIBRARY_NAME);
+    if (c == 0) return &lib->index[mid];
+    if (c < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return NULL;
+}
+
+const uint8_t *cart_image(const library_t *lib, const library_entry_t *e,
+                          uint8_t buf[MEMORY_SIZE]) {
+  const uint8_t *p = lib->data + e->offset;
+
+  if (e->offset > lib->len || e->stored > lib->len - e->offset ||
+      e->size > MEMORY_SIZE)
+    return NULL;
+  if (!(lib->header->flags & LIBRARY_LZ4))
+    return e->stored == MEMORY_SIZE ? p : NULL;
+
+  memset(buf, 0, MEMORY_SIZE);
+  return lz4_unpack(p, e->stored, buf, e->size) ? buf : NULL;
+}
@@ -0,0 +1,629 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "baya.h"
+
+uint8_t scale = 6;
+
+/* INPUT */
+
+uint8_t read_keys() {
+  uint8_t keys = 0;
+
+  if (IsKeyDown(KEY_SPACE) || IsKeyDown(KEY_ENTER))
+    keys |= 1 << (KACTION - 1);
+  if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_W)) keys |= 1 << (KUP - 1);
+  if (IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S)) keys |= 1 << (KDOWN - 1);
+  if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A)) keys |= 1 << (KLEFT - 1);
+  if (IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D)) keys |= 1 << (KRIGHT - 1);
+
+  return keys;
+}
+
+/* WINDOW */
+
+void report_fault(const vm_t *vm) {
+  // only a -DBAYA_CHECKED build ever gets here
+  char text[64] = "";
+
+  if (vm->pc <= MEMORY_SIZE - 4) disassemble(&vm->mem[vm->pc], text, 64);
+  fprintf(stderr, "fault at 0x%03x line %u: %s  %s\n", vm->pc,
+          line_at[vm->pc & (MEMORY_SIZE - 1)], FAULT_NAME[vm->fault], text);
+}
+
+void draw_screen(const uint8_t *screen) {
+  // one rectangle per run of equal pixels in a row
+  const uint8_t(*px)[SCREEN_WIDTH] = (const uint8_t(*)[SCREEN_WIDTH])screen;
+  uint8_t col;
+  int end;
+
+  for (int y = 0; y < SCREEN_HEIGHT; y++) {
+    for (int x = 0; x < SCREEN_WIDTH; x = end) {
+      col = px[y][x];
+      end = x + 1;
+      while (end < SCREEN_WIDTH && px[y][end] == col) end++;
+      DrawRectangle(x * scale, y * scale, (end - x) * scale, scale,
+                    PALETTE[col]);
+    }
+  }
+}
+
+void *open_window() {
+  SetTraceLogLevel(LOG_ERROR);
+  InitWindow(SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale, "🫐 baya");
+  return IsWindowReady() ? (void *)1 : NULL;
+}
+
+uint8_t window_keys(void *b) {
+  (void)b;
+  return read_keys();
+}
+
+bool present_window(void *b, const uint8_t *screen) {
+  (void)b;
+  BeginDrawing();
+  draw_screen(screen);
+  EndDrawing();
+  return !WindowShouldClose();
+}
+
+void close_window(void *b) {
+  (void)b;
+  CloseWindow();
+}
+
+const backend_t RAYLIB_BACKEND = {
+    .name = "raylib",
+    .paced = true,
+    .draws = true,
+    .open = open_window,
+    .keys = window_keys,
+    .present = present_window,
+    .close = close_window,
+};
+
+/* INSPECTOR */
+
+#define INSPECT_ROWS 16 // of 16 bytes in the hex view
+#define INSPECT_LINE 12
+#define INSPECT_WIDTH (40 + 16 * 18)
+#define INSPECT_HEIGHT ((7 + INSPECT_ROWS) * INSPECT_LINE + 4)
+
+typedef struct {
+  bool on;
+  bool follow;   // the hex view keeps ip in sight
+  uint16_t page; // first byte of the hex view
+  RenderTexture2D tex;
+  bool loaded;
+  // what tex shows, so it is only drawn again when one of these changes
+  bool drawn;
+  uint8_t regs[REGISTER_N];
+  uint16_t pc, sp, ip, shown;
+  uint8_t mem[INSPECT_ROWS * 16];
+} inspector_t;
+
+const char REG_LETTER[] = "?xyzwabcdeft";
+
+void resize_window(const inspector_t *in) {
+  int w = SCREEN_WIDTH * scale, h = SCREEN_HEIGHT * scale;
+
+  if (in->on) {
+    w += INSPECT_WIDTH;
+    if (h < INSPECT_HEIGHT) h = INSPECT_HEIGHT;
+  }
+  SetWindowSize(w, h);
+}
+
+void toggle_inspector(inspector_t *in) {
+  in->on = !in->on;
+  if (in->on && !in->loaded) {
+    in->tex = LoadRenderTexture(INSPECT_WIDTH, INSPECT_HEIGHT);
+    in->loaded = true;
+    in->follow = true;
+  }
+  in->drawn = false;
+  resize_window(in);
+}
+
+void page_inspector(inspector_t *in, const vm_t *vm) {
+  // page up and down move the hex view, home follows ip again
+  if (IsKeyPressed(KEY_PAGE_UP)) {
+    in->follow = false;
+    in->page = (in->page - INSPECT_ROWS * 16) & (MEMORY_SIZE - 1);
+  }
+  if (IsKeyPressed(KEY_PAGE_DOWN)) {
+    in->follow = false;
+    in->page = (in->page + INSPECT_ROWS * 16) & (MEMORY_SIZE - 1);
+  }
+  if (IsKeyPressed(KEY_HOME)) in->follow = true;
+  if (in->follow) in->page = vm->ip & ~(INSPECT_ROWS * 16 - 1);
+}
+
+bool inspector_stale(const inspector_t *in, const vm_t *vm) {
+  return !in->drawn || in->pc != vm->pc || in->sp != vm->sp ||
+         in->ip != vm->ip || in->shown != in->page ||
+         memcmp(in->regs, vm->regs, REGISTER_N) != 0 ||
+         memcmp(in->mem, &vm->mem[in->page], sizeof(in->mem)) != 0;
+}
+
+void render_inspector(inspector_t *in, const vm_t *vm) {
+  char text[32];
+  uint16_t at;
+  int y = 4;
+  Color col;
+
+  BeginTextureMode(in->tex);
+  ClearBackground(BLACK);
+
+  // registers by letter and alias, three to a line
+  for (uint8_t r = 1; r < REGISTER_N; r++) {
+    snprintf(text, sizeof(text), "%c %s", REG_LETTER[r],
+             reg_name(r)[1] ? reg_name(r) : "");
+    DrawText(text, 4 + (r - 1) % 3 * 110, y, 10, GRAY);
+    snprintf(text, sizeof(text), "%3u", vm->regs[r - 1]);
+    DrawText(text, 80 + (r - 1) % 3 * 110, y, 10, RAYWHITE);
+    if ((r - 1) % 3 == 2) y += INSPECT_LINE;
+  }
+  y += 2 * INSPECT_LINE;
+
+  snprintf(text, sizeof(text), "pc %03x", vm->pc);
+  DrawText(text, 4, y, 10, RAYWHITE);
+  snprintf(text, sizeof(text), "ip %03x", vm->ip);
+  DrawText(text, 114, y, 10, GOLD);
+  snprintf(text, sizeof(text), "sp %03x  %u saved", vm->sp,
+           (MEMORY_SIZE - 1 - vm->sp) / 9);
+  DrawText(text, 224, y, 10, SKYBLUE);
+  y += 2 * INSPECT_LINE;
+
+  // the sprite at ip in gold, the stack above sp in blue
+  for (uint8_t row = 0; row < INSPECT_ROWS; row++, y += INSPECT_LINE) {
+    at = in->page + row * 16;
+    snprintf(text, sizeof(text), "%03x", at);
+    DrawText(text, 4, y, 10, GRAY);
+
+    for (uint8_t k = 0; k < 16; k++, at++) {
+      if (at >= vm->ip && at < vm->ip + 4)
+        col = GOLD;
+      else if (at > vm->sp)
+        col = SKYBLUE;
+      else
+        col = vm->mem[at] ? RAYWHITE : DARKGRAY;
+      snprintf(text, sizeof(text), "%02x", vm->mem[at]);
+      DrawText(text, 40 + k * 18, y, 10, col);
+    }
+  }
+  EndTextureMode();
+
+  in->drawn = true;
+  memcpy(in->regs, vm->regs, REGISTER_N);
+  in->pc = vm->pc;
+  in->sp = vm->sp;
+  in->ip = vm->ip;
+  in->shown = in->page;
+  memcpy(in->mem, &vm->mem[in->page], sizeof(in->mem));
+}
+
+void draw_inspector(inspector_t *in, const vm_t *vm) {
+  // the panel is a texture, redrawn only when what it shows has changed
+  page_inspector(in, vm);
+  if (inspector_stale(in, vm)) render_inspector(in, vm);
+
+  // render textures are stored upside down
+  DrawTextureRec(in->tex.texture,
+                 (Rectangle){0, 0, INSPECT_WIDTH, -INSPECT_HEIGHT},
+                 (Vector2){SCREEN_WIDTH * scale, 0}, WHITE);
+}
+
+/* HUD */
+
+void draw_hud(const telemetry_t *t) {
+  // where the last frame went, and how bad the worst one in a hundred is
+  char text[64];
+  int y = 4;
+
+  DrawRectangle(0, 0, 190, 8 + (PHASE_N + 1) * 11, (Color){0, 0, 0, 160});
+  for (phase_t p = 0; p < PHASE_N; p++, y += 11) {
+    snprintf(text, sizeof(text), "%-8s %6.2f ms  p99 %6.2f", PHASE_NAME[p],
+             t->last_ns[p] / 1e6, phase_percentile(t, p, 0.99) / 1e6);
+    DrawText(text, 4, y, 10, RAYWHITE);
+  }
+  snprintf(text, sizeof(text), "%llu instructions  %llu sprites",
+           (unsigned long long)t->last_instructions,
+           (unsigned long long)t->last_sprites);
+  DrawText(text, 4, y, 10, GOLD);
+}
+
+video_t *toggle_gif(video_t *gif, uint8_t threads) {
+  static char name[64];
+
+  if (gif) {
+    close_video(gif);
+    fprintf(stderr, "saved %s\n", name);
+    return NULL;
+  }
+
+  snprintf(name, sizeof(name), "baya-%ld.gif", (long)time(NULL));
+  if ((gif = open_video(VIDEO_GIF, name, scale, threads)) == NULL)
+    fprintf(stderr, "couldn't open %s\n", name);
+  else
+    fprintf(stderr, "recording %s\n", name);
+  return gif;
+}
+
+void run_window(vm_t *vm, FILE *record, uint8_t threads, telemetry_t *tm) {
+  rewind_t rw;
+  long recorded = 0;
+  video_t *gif = NULL;
+  inspector_t in = {0};
+  bool hud = false;
+  counts_t counts = {0};
+  uint64_t ns[PHASE_N], t0, t1, next;
+  uint64_t instructions, sprites;
+
+  init_rewind(&rw, REWIND_SECONDS);
+  record_frame(&rw, vm);
+  open_window();
+
+  // frames are paced here rather than in EndDrawing, so the wait can be
+  // told apart from the time it takes to present
+  next = now_ns();
+
+  while (!WindowShouldClose()) {
+    t0 = now_ns();
+    ns[PHASE_EXEC] = 0;
+    instructions = counts.instructions;
+    sprites = counts.sprites;
+    vm->counts = hud || tm->csv || tm->metrics ? &counts : NULL;
+
+    if (IsKeyDown(KEY_BACKSPACE) && rewind_frame(&rw, vm)) {
+      // hold backspace to step back, the input log follows along
+      if (recorded > 0) recorded--;
+      vm->fault = 0;
+    } else if (!vm->fault) {
+      // a fault freezes the cart until it is rewound past
+      vm->keys = window_keys(NULL);
+      t1 = now_ns();
+      run_frame(vm);
+      ns[PHASE_EXEC] = now_ns() - t1;
+      record_frame(&rw, vm);
+      if (vm->fault) report_fault(vm);
+
+      if (record) {
+        fseek(record, recorded++, SEEK_SET);
+        fputc(vm->keys, record);
+      }
+    }
+
+    // f9 starts and stops a gif of what is on screen
+    if (IsKeyPressed(KEY_F9)) gif = toggle_gif(gif, threads);
+    if (gif) push_video(gif, &vm->screen[0][0]);
+
+    // f1 shows registers and memory beside the screen, f3 frame timings
+    if (IsKeyPressed(KEY_F1)) toggle_inspector(&in);
+    if (IsKeyPressed(KEY_F3)) hud = !hud;
+
+    t1 = now_ns();
+    ns[PHASE_UPDATE] = t1 - t0 - ns[PHASE_EXEC];
+
+    BeginDrawing();
+    if (in.on) {
+      ClearBackground(BLACK);
+      draw_inspector(&in, vm);
+    }
+    draw_screen(&vm->screen[0][0]);
+    if (hud) draw_hud(tm);
+
+    t0 = now_ns();
+    ns[PHASE_DRAW] = t0 - t1;
+    EndDrawing();
+    t1 = now_ns();
+    ns[PHASE_PRESENT] = t1 - t0;
+
+    // a frame that ran late doesn't make the next ones hurry
+    next += 1000000000ull / FPS;
+    if (next > t1)
+      WaitTime((next - t1) / 1e9);
+    else
+      next = t1;
+    ns[PHASE_IDLE] = now_ns() - t1;
+
+    add_frame(tm, ns, counts.instructions - instructions,
+              counts.sprites - sprites);
+  }
+
+  vm->counts = NULL;
+  if (in.loaded) UnloadRenderTexture(in.tex);
+  close_window(NULL);
+  free_rewind(&rw);
+  if (gif) toggle_gif(gif, threads);
+
+  if (record) {
+    fflush(record);
+    if (ftruncate(fileno(record), recorded) != 0) perror("record");
+    fclose(record);
+  }
+}
+
+/* HEADLESS */
+
+int run_headless(vm_t *vm, video_format_t format, char *path, uint32_t frames,
+                 FILE *input, uint8_t threads) {
+  video_t *v;
+  int c;
+  int status = 0;
+
+  if ((v = open_video(format, path, scale, threads)) == NULL) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return 1;
+  }
+  for (uint32_t f = 0; f < frames; f++) {
+    if (input) {
+      if ((c = fgetc(input)) == EOF) break;
+      vm->keys = c;
+    }
+    run_frame(vm);
+    push_video(v, &vm->screen[0][0]);
+
+    if (vm->fault) {
+      report_fault(vm);
+      status = 1;
+      break;
+    }
+  }
+
+  close_video(v);
+  return status;
+}
+
+const backend_t *BACKENDS[] = {&RAYLIB_BACKEND, &SOFT_BACKEND, &TERM_BACKEND,
+                                &NULL_BACKEND};
+
+const backend_t *find_backend(const char *name) {
+  for (size_t i = 0; i < sizeof(BACKENDS) / sizeof(BACKENDS[0]); i++)
+    if (strcmp(BACKENDS[i]->name, name) == 0) return BACKENDS[i];
+  return NULL;
+}
+
+int run_backend(vm_t *vm, const backend_t *be, uint32_t frames, FILE *input) {
+  // the bare loop, for the window's tools see run_window
+  void *b = be->open();
+  uint64_t start = now_ns(), next = start;
+  struct timespec wait;
+  int64_t ns;
+  uint32_t f;
+  int c;
+  int status = 0;
+
+  if (b == NULL) {
+    fprintf(stderr, "couldn't open the %s backend\n", be->name);
+    return 1;
+  }
+  vm->no_draw = !be->draws;
+
+  for (f = 0; f < frames; f++) {
+    if (input) {
+      if ((c = fgetc(input)) == EOF) break;
+      vm->keys = c;
+    } else
+      vm->keys = be->keys(b);
+
+    run_frame(vm);
+    if (!be->present(b, &vm->screen[0][0])) break;
+    if (vm->fault) {
+      status = 1;
+      break;
+    }
+
+    if (!be->paced) continue;
+    next += 1000000000 / FPS;
+    if ((ns = next - now_ns()) > 0) {
+      wait.tv_sec = ns / 1000000000;
+      wait.tv_nsec = ns % 1000000000;
+      nanosleep(&wait, NULL);
+    }
+  }
+
+  be->close(b);
+  if (vm->fault) report_fault(vm);
+  if (!be->paced)
+    fprintf(stderr, "%u frames in %.3f s, %.0f per second\n", f,
+            (now_ns() - start) / 1e9, f / ((now_ns() - start) / 1e9));
+  return status;
+}
+
+/* MAIN */
+
+print_format_t find_print_format(const char *name) {
+  const char *names[] = {"lines", "json", "binary"};
+
+  for (uint8_t i = 0; i < 3; i++)
+    if (strcmp(names[i], name) == 0) return PRINT_LINES + i;
+  return 0;
+}
+
+bool read_library(const char *path, const char *name) {
+  // leaves the image in mem and its size in pc, as read_file does, but with
+  // nothing to assemble
+  library_t *lib = open_library(path);
+  const library_entry_t *e;
+  const uint8_t *image = NULL;
+
+  if (lib == NULL) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return false;
+  }
+  if ((e = find_cart(lib, name)) && (image = cart_image(lib, e, mem))) {
+    if (image != mem) memcpy(mem, image, MEMORY_SIZE);
+    pc = e->size;
+  } else
+    fprintf(stderr, e ? "%s is damaged in %s\n" : "no %s in %s\n", name, path);
+  close_library(lib);
+  return image != NULL;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: baya [cart.baya] [-seed N] [-record FILE]\n"
+          "            [-y4m FILE | -rgb FILE | -png DIR | -gif FILE]\n"
+          "            [-frames N] [-input FILE] [-scale N] [-threads N]\n"
+          "            [-profile PREFIX] [-trace FILE] [-debug]\n"
+          "            [-csv FILE] [-metrics FILE]\n"
+          "            [-print lines|json|binary] [-print-limit N]\n"
+          "       baya -lib FILE NAME [...]\n"
+          "       baya cart.baya -backend raylib|soft|term|null [-frames N]\n"
+          "            [-input FILE] [-seed N]\n"
+          "       baya -serve SOCKET [-threads N]\n");
+  exit(1);
+}
+
+FILE *open_or_die(char *name, char *mode) {
+  FILE *f = fopen(name, mode);
+  if (f == NULL) {
+    fprintf(stderr, "couldn't open %s\n", name);
+    exit(1);
+  }
+  return f;
+}
+
+int main(int argc, char **argv) {
+  static vm_t vm;
+  char *cart = "game.baya";
+  char *video = NULL;
+  char *profile = NULL;
+  char *trace = NULL;
+  char *csv = NULL;
+  char *metrics = NULL;
+  char *server = NULL;
+  char *library = NULL;
+  telemetry_t *tm;
+  video_format_t format = 0;
+  uint32_t frames = 0;
+  uint32_t seed = RANDOM_SEED;
+  FILE *input = NULL;
+  FILE *record = NULL;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  long zoom = scale;
+  bool debug = false;
+  const backend_t *backend = NULL;
+  print_format_t print_format = PRINT_LINES;
+  uint64_t print_limit = 0;
+  printer_t *printer = NULL;
+  int status = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-')
+      cart = argv[i];
+    else if (strcmp(argv[i], "-debug") == 0)
+      debug = true;
+    else if (strcmp(argv[i], "-term") == 0)
+      backend = &TERM_BACKEND;
+    else if (i + 1 == argc)
+      usage();
+    else if (strcmp(argv[i], "-seed") == 0)
+      seed = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-record") == 0)
+      record = open_or_die(argv[++i], "wb");
+    else if (strcmp(argv[i], "-input") == 0)
+      input = open_or_die(argv[++i], "rb");
+    else if (strcmp(argv[i], "-frames") == 0)
+      frames = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-scale") == 0)
+      zoom = atol(argv[++i]);
+    else if (strcmp(argv[i], "-threads") == 0)
+      threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-profile") == 0)
+      profile = argv[++i];
+    else if (strcmp(argv[i], "-trace") == 0)
+      trace = argv[++i];
+    else if (strcmp(argv[i], "-csv") == 0)
+      csv = argv[++i];
+    else if (strcmp(argv[i], "-metrics") == 0)
+      metrics = argv[++i];
+    else if (strcmp(argv[i], "-serve") == 0)
+      server = argv[++i];
+    else if (strcmp(argv[i], "-lib") == 0)
+      library = argv[++i];
+    else if (strcmp(argv[i], "-print-limit") == 0)
+      print_limit = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-print") == 0) {
+      if ((print_format = find_print_format(argv[++i])) == 0) usage();
+    } else if (strcmp(argv[i], "-backend") == 0) {
+      if ((backend = find_backend(argv[++i])) == NULL) usage();
+    } else if (strcmp(argv[i], "-y4m") == 0) {
+      format = VIDEO_Y4M;
+      video = argv[++i];
+    } else if (strcmp(argv[i], "-rgb") == 0) {
+      format = VIDEO_RGB;
+      video = argv[++i];
+    } else if (strcmp(argv[i], "-png") == 0) {
+      format = VIDEO_PNG;
+      video = argv[++i];
+    } else if (strcmp(argv[i], "-gif") == 0) {
+      format = VIDEO_GIF;
+      video = argv[++i];
+    } else
+      usage();
+  }
+
+  // clamped before it narrows, so 256 isn't taken for 0
+  scale = zoom < 1 ? 1 : zoom > VIDEO_SCALE_MAX ? VIDEO_SCALE_MAX : zoom;
+  if (threads < 1) threads = 1;
+  if (threads > 255) threads = 255;
+
+  // sessions load their own carts
+  if (server) return serve(server, threads);
+
+  if (library == NULL)
+    read_file(cart);
+  else if (!read_library(library, cart))
+    return 1;
+  init_vm(&vm, mem);
+  vm.stack_floor = pc;
+  seed_random(&vm, seed);
+  if (profile) vm.profile = calloc(1, sizeof(profile_t));
+  if (trace && (vm.trace = open_trace(trace)) == NULL) {
+    fprintf(stderr, "couldn't open %s\n", trace);
+    return 1;
+  }
+  if (debug) attach_debugger(&vm);
+
+  // keep print out of a video or terminal going to stdout, and format it on
+  // a thread of its own, unless the debugger wants it in line with its own
+  if ((video && strcmp(video, "-") == 0) || (backend && backend->on_stdout))
+    vm.out = stderr;
+  if (!debug) {
+    printer = open_printer(vm.out, print_format, print_limit);
+    vm.print = open_print(printer, 0);
+  }
+
+  if (backend && (backend != &RAYLIB_BACKEND || frames)) {
+    // the window with its tools runs until closed, a bounded run is bare;
+    // someone watching stops when they like, the rest need an end
+    if (frames == 0) frames = input || backend->paced ? UINT32_MAX : FPS * 10;
+    status = run_backend(&vm, backend, frames, input);
+  } else if (video) {
+    // without -frames, an input log plays to its end
+    if (frames == 0) frames = input ? UINT32_MAX : FPS * 10;
+    status = run_headless(&vm, format, video, frames, input, threads);
+  } else {
+    for (int i = 0; i < pc; i++) {
+      printf("%x", mem[i]);
+    }
+    putchar('\n');
+
+    if ((tm = open_telemetry(csv, metrics)) == NULL) {
+      fprintf(stderr, "couldn't open %s\n", csv);
+      return 1;
+    }
+    run_window(&vm, record, threads, tm);
+    close_telemetry(tm);
+  }
+
+  if (printer) close_printer(printer);
+  if (profile) write_profile(vm.profile, cart, profile);
+  if (vm.trace) close_trace(vm.trace);
+
+  return status;
+}
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "baya.h"
+
+#define PRINT_BUF (64 << 10) // formatted output between writes
+
+/* PRINTER */
+/* carts only append records to their channel, and this thread formats */
+/* them all, so a line is only ever written whole and by one thread */
+
+struct printer_t {
+  FILE *file;
+  print_format_t format;
+  uint64_t limit;
+  pthread_mutex_t lock; // over the list of channels
+  print_t *channels;
+  print_t **last;
+  _Atomic bool stop;
+  pthread_t drainer;
+  pthread_mutex_t nap; // the drainer's, between passes that found nothing
+  pthread_cond_t wake; // cut short when a channel fills up
+  _Atomic bool full;
+  char buf[PRINT_BUF];
+  size_t len;
+};
+
+static char *put_u32(char *o, uint32_t n) {
+  char digits[10];
+  uint8_t d = 0;
+
+  do digits[d++] = '0' + n % 10;
+  while (n /= 10);
+  while (d) *o++ = digits[--d];
+  return o;
+}
+
+static char *put_str(char *o, const char *s) {
+  size_t n = strlen(s);
+
+  memcpy(o, s, n);
+  return o + n;
+}
+
+static void put_record(printer_t *p, const print_record_t *r) {
+  // by hand rather than with printf, which costs more than the rest of
+  // a record's trip
+  char *o = p->buf + p->len;
+  const char *reg;
+
+  switch (p->format) {
+  case PRINT_LINES:
+    // as print always wrote it
+    o = put_u32(o, r->value);
+    *o++ = '\n';
+    break;
+  case PRINT_JSON:
+    o = put_str(o, "{\"id\": ");
+    o = put_u32(o, r->id);
+    o = put_str(o, ", \"t\": ");
+    o = put_u32(o, r->t);
+    o = put_str(o, ", \"reg\": \"");
+    // an alias is any token, so may need escaping
+    for (reg = reg_name(r->reg); *reg; *o++ = *reg++)
+      if (*reg == '"' || *reg == '\\') *o++ = '\\';
+    o = put_str(o, "\", \"value\": ");
+    o = put_u32(o, r->value);
+    o = put_str(o, "}\n");
+    break;
+  case PRINT_BINARY:
+    // id and t as 4 bytes each, little endian, then the register and value
+    for (uint8_t i = 0; i < 4; i++) {
+      o[i] = r->id >> 8 * i;
+      o[4 + i] = r->t >> 8 * i;
+    }
+    o[8] = r->reg;
+    o[9] = r->value;
+    o += 10;
+    break;
+  }
+  p->len = o - p->buf;
+}
+
+static void flush_printer(printer_t *p) {
+  fwrite(p->buf, 1, p->len, p->file);
+  p->len = 0;
+}
+
+static uint32_t drain(printer_t *p) {
+  // everything in every channel, and how much that was
+  uint32_t head, tail, n = 0;
+
+  pthread_mutex_lock(&p->lock);
+  for (print_t *c = p->channels; c; c = c->next) {
+    head = atomic_load_explicit(&c->head, memory_order_acquire);
+    tail = atomic_load_explicit(&c->tail, memory_order_relaxed);
+    for (; tail != head; tail++, n++) {
+      // room for the longest record, a json one with a long alias
+      if (p->len > PRINT_BUF - 2 * TOKEN_LENGTH - 64) flush_printer(p);
+      put_record(p, &c->buf[tail & (PRINT_RING - 1)]);
+    }
+    atomic_store_explicit(&c->tail, tail, memory_order_release);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return n;
+}
+
+static void *drain_prints(void *arg) {
+  printer_t *p = arg;
+  struct timespec until;
+  bool stop, written = false;
+
+  for (;;) {
+    // stop is read first, so an empty pass after it has seen every record
+    stop = atomic_load(&p->stop);
+    if (drain(p)) {
+      written = true;
+      continue;
+    }
+    if (stop) break;
+
+    // someone may be watching, so what there is goes out before a nap
+    if (written) {
+      flush_printer(p);
+      fflush(p->file);
+    }
+    written = false;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    if ((until.tv_nsec += 1000000) >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&p->nap);
+    if (!atomic_exchange(&p->full, false))
+      pthread_cond_timedwait(&p->wake, &p->nap, &until);
+    pthread_mutex_unlock(&p->nap);
+  }
+  return NULL;
+}
+
+static void wait_print(print_t *c) {
+  // the printer may be napping, and a ring drains much faster than it
+  // fills back up, so wake it instead of waiting the nap out
+  printer_t *p = c->printer;
+
+  pthread_mutex_lock(&p->nap);
+  atomic_store(&p->full, true);
+  pthread_cond_signal(&p->wake);
+  pthread_mutex_unlock(&p->nap);
+  sched_yield();
+}
+
+printer_t *open_printer(FILE *f, print_format_t format, uint64_t limit) {
+  printer_t *p = calloc(1, sizeof(printer_t));
+
+  p->file = f;
+  p->format = format;
+  p->limit = limit ? limit : UINT64_MAX;
+  p->last = &p->channels;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_mutex_init(&p->nap, NULL);
+  pthread_cond_init(&p->wake, NULL);
+  if (format == PRINT_BINARY) {
+    memcpy(p->buf, PRINT_MAGIC, strlen(PRINT_MAGIC));
+    p->len = strlen(PRINT_MAGIC);
+  }
+
+  pthread_create(&p->drainer, NULL, drain_prints, p);
+  return p;
+}
+
+print_t *open_print(printer_t *p, uint32_t id) {
+  print_t *c = calloc(1, sizeof(print_t));
+
+  c->id = id;
+  c->left = p->limit;
+  c->printer = p;
+  c->wait = wait_print;
+  pthread_mutex_lock(&p->lock);
+  *p->last = c;
+  p->last = &c->next;
+  pthread_mutex_unlock(&p->lock);
+  return c;
+}
+
+void close_printer(printer_t *p) {
+  print_t *next;
+
+  atomic_store(&p->stop, true);
+  pthread_join(p->drainer, NULL);
+  flush_printer(p);
+  fflush(p->file);
+
+  for (print_t *c = p->channels; c; c = next) {
+    if (c->dropped)
+      fprintf(stderr, "channel %u: %llu prints past the limit dropped\n", c->id,
+              (unsigned long long)c->dropped);
+    next = c->next;
+    free(c);
+  }
+  pthread_mutex_destroy(&p->lock);
+  pthread_mutex_destroy(&p->nap);
+  pthread_cond_destroy(&p->wake);
+  free(p);
+}
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "baya.h"
+
+#define PROFILE_HOT 20
+
+static const char *ins_name(uint8_t o) {
+  return o <= TRAP ? INS_NAME[o] : INS_NAME[0];
+}
+
+static const char *label_name(uint16_t at) {
+  int l = label_before(at);
+  return l < 0 ? "(start)" : label[l];
+}
+
+static const uint64_t *counts;
+
+static int by_count(const void *a, const void *b) {
+  uint64_t x = counts[*(const uint16_t *)a];
+  uint64_t y = counts[*(const uint16_t *)b];
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void write_report(FILE *f, const profile_t *p, const char *cart) {
+  static uint16_t hot[MEMORY_SIZE];
+  uint64_t per_label[LABEL_MAX + 1] = {0};
+  uint64_t total = 0;
+  uint16_t n = 0;
+  int l;
+
+  for (int o = 0; o < 256; o++) total += p->ops[o];
+  if (total == 0) total = 1;
+
+  fprintf(f, "profile of %s\n\n", cart);
+  fprintf(f, "%-16s %12llu\n", "instructions", (unsigned long long)total);
+  fprintf(f, "%-16s %12llu calls %10.3f ms\n", "sprite",
+          (unsigned long long)p->ops[SPRITE], p->sprite_ns / 1e6);
+  fprintf(f, "%-16s %12llu calls %10.3f ms\n", "clear",
+          (unsigned long long)p->ops[CLEAR], p->clear_ns / 1e6);
+
+  fprintf(f, "\n%-16s %12s %7s\n", "opcode", "count", "share");
+  for (int o = 0; o < 256; o++)
+    if (p->ops[o])
+      fprintf(f, "%-16s %12llu %6.2f%%\n", ins_name(o),
+              (unsigned long long)p->ops[o], 100.0 * p->ops[o] / total);
+
+  for (uint16_t at = 0; at < MEMORY_SIZE; at++) {
+    if (!p->at[at]) continue;
+    hot[n++] = at;
+    l = label_before(at);
+    per_label[l < 0 ? LABEL_MAX : l] += p->at[at];
+  }
+
+  fprintf(f, "\n%-16s %12s %7s\n", "label", "count", "share");
+  if (per_label[LABEL_MAX])
+    fprintf(f, "%-16s %12llu %6.2f%%\n", "(start)",
+            (unsigned long long)per_label[LABEL_MAX],
+            100.0 * per_label[LABEL_MAX] / total);
+  for (uint8_t i = 0; i < label_n; i++)
+    if (per_label[i])
+      fprintf(f, "%-16s %12llu %6.2f%%\n", label[i],
+              (unsigned long long)per_label[i], 100.0 * per_label[i] / total);
+
+  counts = p->at;
+  qsort(hot, n, sizeof(hot[0]), by_count);
+
+  fprintf(f, "\n%-6s %5s %-16s %-16s %12s %7s\n", "offset", "line", "label",
+          "opcode", "count", "share");
+  for (uint16_t i = 0; i < n && i < PROFILE_HOT; i++)
+    fprintf(f, "0x%03x  %5u %-16s %-16s %12llu %6.2f%%\n", hot[i],
+            line_at[hot[i]], label_name(hot[i]), ins_name(mem[hot[i]]),
+            (unsigned long long)p->at[hot[i]], 100.0 * p->at[hot[i]] / total);
+}
+
+static void write_folded(FILE *f, const profile_t *p, const char *cart) {
+  // cart;label;line opcode count, one line per instruction, as taken by
+  // flamegraph.pl and speedscope
+  const char *base = strrchr(cart, '/');
+  base = base ? base + 1 : cart;
+
+  for (uint16_t at = 0; at < MEMORY_SIZE; at++)
+    if (p->at[at])
+      fprintf(f, "%s;%s;%u %s %llu\n", base, label_name(at), line_at[at],
+              ins_name(mem[at]), (unsigned long long)p->at[at]);
+}
+
+void write_profile(const profile_t *p, const char *cart, const char *prefix) {
+  char name[4096];
+  FILE *f;
+
+  snprintf(name, sizeof(name), "%s.txt", prefix);
+  if ((f = fopen(name, "w")) == NULL) {
+    fprintf(stderr, "couldn't write %s\n", name);
+    return;
+  }
+  write_report(f, p, cart);
+  fclose(f);
+
+  snprintf(name, sizeof(name), "%s.folded", prefix);
+  if ((f = fopen(name, "w")) == NULL) {
+    fprintf(stderr, "couldn't write %s\n", name);
+    return;
+  }
+  write_folded(f, p, cart);
+  fclose(f);
+}
@@ -1,3 +1,3 @@
 #!/bin/sh
 
-cc baya.c -lraylib -lm && ./a.out && rm ./a.out
+cc baya.c video.c profile.c trace.c debug.c telemetry.c server.c term.c backend.c library.c print.c main.c -lraylib -lm -lpthread && ./a.out && rm ./a.out
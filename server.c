@@ -0,0 +1,349 @@
+#define _GNU_SOURCE // accept4
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "baya.h"
+
+#define SERVE_BACKLOG (4 << 20) // replies held before a session stops reading
+#define SERVE_BUDGET (1 << 26)  // instructions one step may run, under a second
+
+/* SESSIONS */
+/* each connection is armed one shot, so whichever thread epoll wakes has */
+/* the session to itself until it arms it again, and needs no lock */
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} bytes_t;
+
+typedef struct {
+  int fd;
+  bool loaded;  // a cart is in vm
+  bool eof;     // the peer sent all it will, so close once it has replies
+  bool closing; // the stream can't be trusted any more, so read no further
+  bytes_t in;
+  bytes_t out;
+  vm_t vm;
+} session_t;
+
+typedef struct {
+  int epoll;
+  int listener;
+  pthread_t workers[255];
+  uint8_t threads;
+} server_t;
+
+static void reserve(bytes_t *b, size_t n) {
+  if (b->len + n <= b->cap) return;
+  while (b->len + n > b->cap) b->cap = b->cap ? b->cap * 2 : 4096;
+  b->data = realloc(b->data, b->cap);
+}
+
+static void put_bytes(bytes_t *b, const void *p, size_t n) {
+  reserve(b, n);
+  memcpy(b->data + b->len, p, n);
+  b->len += n;
+}
+
+static uint32_t get_u32_le(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static void put_header(bytes_t *b, serve_op_t op, uint8_t flags,
+                       uint16_t frames, uint32_t len) {
+  uint8_t h[SERVE_HEADER] = {op, flags, frames & 0xff, frames >> 8};
+
+  for (uint8_t i = 0; i < 4; i++) h[4 + i] = len >> 8 * i;
+  put_bytes(b, h, SERVE_HEADER);
+}
+
+static void reply_error(session_t *s, const char *msg) {
+  put_header(&s->out, SERVE_ERROR, 0, 0, strlen(msg));
+  put_bytes(&s->out, msg, strlen(msg));
+}
+
+static void start_cart(session_t *s, const uint8_t *image, size_t size,
+                       uint32_t seed) {
+  uint8_t full[MEMORY_SIZE] = {0};
+
+  memcpy(full, image, size);
+  init_vm(&s->vm, full);
+  seed_random(&s->vm, seed);
+  s->vm.out = NULL;
+  // any client can send any image, so none may crash or hold a thread
+  s->vm.guarded = true;
+  s->vm.stack_floor = size;
+  s->loaded = true;
+}
+
+static void load(session_t *s, const uint8_t *p, uint32_t len) {
+  if (len < 4 || len - 4 > MEMORY_SIZE) {
+    reply_error(s, "an image is a seed and up to 4096 bytes");
+    return;
+  }
+  start_cart(s, p + 4, len - 4, get_u32_le(p));
+  put_header(&s->out, SERVE_OK, 0, 0, 0);
+}
+
+static void assemble_cart(session_t *s, const uint8_t *p, uint32_t len) {
+  cart_t cart;
+  char *text;
+  size_t text_len;
+  FILE *f;
+
+  if (len < 4) {
+    reply_error(s, "a source is a seed and the text of a cart");
+    return;
+  }
+
+  if (baya_assemble((const char *)p + 4, len - 4, &cart)) {
+    start_cart(s, cart.image, cart.size, get_u32_le(p));
+    put_header(&s->out, SERVE_OK, 0, 0, 0);
+  } else if ((f = open_memstream(&text, &text_len))) {
+    print_diags(f, cart.diags, cart.diag_n);
+    fclose(f);
+    reply_error(s, text);
+    free(text);
+  } else
+    reply_error(s, "couldn't format diagnostics");
+}
+
+static void step(session_t *s, uint8_t flags, const uint8_t *keys,
+                 uint32_t frames) {
+  size_t per = (flags & SERVE_HASH ? 8 : 0) +
+               (flags & SERVE_SCREEN ? sizeof(s->vm.screen) : 0);
+  size_t at;
+  uint64_t h;
+  uint32_t f;
+
+  if (!s->loaded) {
+    reply_error(s, "no cart loaded");
+    return;
+  }
+  if (frames > SERVE_FRAMES_MAX) {
+    reply_error(s, "too many frames in one step");
+    return;
+  }
+
+  // the header goes in first and gets the frame count once it is known
+  at = s->out.len;
+  put_header(&s->out, SERVE_OK, 0, 0, 0);
+  reserve(&s->out, per * frames);
+
+  s->vm.budget = SERVE_BUDGET;
+  for (f = 0; f < frames && !s->vm.fault; f++) {
+    s->vm.keys = keys[f];
+    run_frame(&s->vm);
+    if (flags & SERVE_HASH) {
+      h = baya_hash(&s->vm);
+      for (uint8_t i = 0; i < 8; i++) s->out.data[s->out.len++] = h >> 8 * i;
+    }
+    if (flags & SERVE_SCREEN)
+      put_bytes(&s->out, s->vm.screen, sizeof(s->vm.screen));
+  }
+
+  s->out.len = at;
+  put_header(&s->out, SERVE_OK, s->vm.fault, f, per * f);
+  s->out.len += per * f;
+}
+
+static void handle(session_t *s) {
+  // answers every whole request in, as long as the replies get sent
+  const uint8_t *p;
+  uint32_t len;
+  size_t used = 0;
+
+  while (!s->closing && s->in.len - used >= SERVE_HEADER &&
+         s->out.len < SERVE_BACKLOG) {
+    p = s->in.data + used;
+    len = get_u32_le(p + 4);
+
+    if (len > SERVE_MESSAGE_MAX) {
+      // the length can't be skipped over safely, so this is the last reply
+      reply_error(s, "message too long");
+      s->closing = true;
+      break;
+    }
+    if (s->in.len - used < SERVE_HEADER + len) break;
+    used += SERVE_HEADER + len;
+
+    switch (p[0]) {
+    case SERVE_LOAD:
+      load(s, p + SERVE_HEADER, len);
+      break;
+    case SERVE_ASSEMBLE:
+      assemble_cart(s, p + SERVE_HEADER, len);
+      break;
+    case SERVE_STEP:
+      step(s, p[1], p + SERVE_HEADER, len);
+      break;
+    default:
+      reply_error(s, "unknown request");
+      break;
+    }
+  }
+
+  memmove(s->in.data, s->in.data + used, s->in.len - used);
+  s->in.len -= used;
+}
+
+static bool receive(session_t *s) {
+  // false once the peer has closed its end; a whole message at most is
+  // read ahead, the rest waits in the socket
+  ssize_t n;
+
+  while (s->in.len < SERVE_HEADER + SERVE_MESSAGE_MAX) {
+    reserve(&s->in, 4096);
+    n = recv(s->fd, s->in.data + s->in.len, s->in.cap - s->in.len, 0);
+    if (n > 0) {
+      s->in.len += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  return true;
+}
+
+static bool send_out(session_t *s) {
+  // false if the connection broke; what is left moves to the front, so
+  // out.len is always what is waiting to go
+  size_t sent = 0;
+  ssize_t n;
+  bool ok = true;
+
+  while (sent < s->out.len) {
+    n = send(s->fd, s->out.data + sent, s->out.len - sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    ok = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    break;
+  }
+  if (sent) {
+    memmove(s->out.data, s->out.data + sent, s->out.len - sent);
+    s->out.len -= sent;
+  }
+  return ok;
+}
+
+static void close_session(session_t *s) {
+  close(s->fd);
+  free(s->in.data);
+  free(s->out.data);
+  free(s);
+}
+
+static void serve_session(server_t *sv, session_t *s, uint32_t events) {
+  struct epoll_event ev = {0};
+  size_t pending;
+
+  if (events & EPOLLERR) {
+    close_session(s);
+    return;
+  }
+  if (events & (EPOLLIN | EPOLLHUP) && !s->eof && !receive(s)) s->eof = true;
+
+  // replies that didn't fit in the backlog leave requests waiting, so
+  // keep going while sending makes room for more
+  do {
+    pending = s->in.len;
+    handle(s);
+    if (!send_out(s)) {
+      close_session(s);
+      return;
+    }
+  } while (s->in.len && s->in.len != pending);
+
+  if ((s->eof || s->closing) && s->out.len == 0) {
+    close_session(s);
+    return;
+  }
+
+  ev.events = EPOLLONESHOT | (s->out.len ? EPOLLOUT : 0) |
+              (s->eof || s->closing || s->out.len >= SERVE_BACKLOG ? 0
+                                                                   : EPOLLIN);
+  ev.data.ptr = s;
+  epoll_ctl(sv->epoll, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+static void accept_sessions(server_t *sv) {
+  struct epoll_event ev = {0};
+  session_t *s;
+  int fd;
+
+  while ((fd = accept4(sv->listener, NULL, NULL,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    s = calloc(1, sizeof(session_t));
+    s->fd = fd;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = s;
+    epoll_ctl(sv->epoll, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  // the listener is armed one shot too, so only one thread accepts at once
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = NULL;
+  epoll_ctl(sv->epoll, EPOLL_CTL_MOD, sv->listener, &ev);
+}
+
+static void *serve_worker(void *arg) {
+  server_t *sv = arg;
+  struct epoll_event ev;
+
+  for (;;) {
+    if (epoll_wait(sv->epoll, &ev, 1, -1) < 1) continue;
+    if (ev.data.ptr == NULL)
+      accept_sessions(sv);
+    else
+      serve_session(sv, ev.data.ptr, ev.events);
+  }
+  return NULL;
+}
+
+/* SERVER */
+
+int serve(const char *path, uint8_t threads) {
+  static server_t sv;
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT};
+  struct stat st;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  // a socket left behind by an earlier run would make bind fail, but
+  // anything else there is left for bind to refuse
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+  sv.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sv.listener < 0 ||
+      bind(sv.listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(sv.listener, SOMAXCONN) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  sv.epoll = epoll_create1(EPOLL_CLOEXEC);
+  ev.data.ptr = NULL;
+  epoll_ctl(sv.epoll, EPOLL_CTL_ADD, sv.listener, &ev);
+
+  sv.threads = threads < 1 ? 1 : threads;
+  for (uint8_t i = 0; i < sv.threads; i++)
+    pthread_create(&sv.workers[i], NULL, serve_worker, &sv);
+  for (uint8_t i = 0; i < sv.threads; i++) pthread_join(sv.workers[i], NULL);
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "baya.h"
+
+/* TELEMETRY */
+/* per phase histograms of frame time, with buckets a half power of two of */
+/* a microsecond apart, so 40 of them reach from 1 us past a second */
+
+const char *PHASE_NAME[] = {"exec", "update", "draw", "present", "idle"};
+
+static uint8_t bucket_of(uint64_t ns) {
+  // 2 buckets per doubling, the second starting at 1.5 times the first;
+  // counted in half microseconds so that 1 to 2 us splits like the rest
+  uint64_t half = ns / 500;
+  uint8_t b = 1;
+
+  if (half < 2) return 0;
+  while (half >> (b + 1)) b++;
+  b = 2 * b - 1 + (half >> (b - 1) & 1);
+  return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+static uint64_t bucket_top(uint8_t b) {
+  // the upper bound of a bucket in ns
+  if (b == 0) return 1000;
+  b--;
+  return (b & 1 ? 2000ull : 1500ull) << (b / 2);
+}
+
+telemetry_t *open_telemetry(const char *csv, const char *metrics) {
+  telemetry_t *t = calloc(1, sizeof(telemetry_t));
+
+  if (csv) {
+    if ((t->csv = fopen(csv, "w")) == NULL) {
+      free(t);
+      return NULL;
+    }
+    fprintf(t->csv, "frame,exec_us,update_us,draw_us,present_us,idle_us,"
+                    "instructions,sprites\n");
+  }
+  t->metrics = metrics;
+  return t;
+}
+
+uint64_t phase_percentile(const telemetry_t *t, phase_t p, double q) {
+  // the top of the bucket that holds the q-th frame
+  uint64_t seen = 0, want = q * t->frames;
+
+  for (uint8_t b = 0; b < HIST_BUCKETS; b++)
+    if ((seen += t->hist[p][b]) > want) return bucket_top(b);
+  return t->max_ns[p];
+}
+
+static void write_metrics(const telemetry_t *t) {
+  // written aside and renamed over, so a reader never sees half a file
+  static const double QUANTILES[] = {0.5, 0.9, 0.99};
+  char tmp[256];
+  FILE *f;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", t->metrics);
+  if ((f = fopen(tmp, "w")) == NULL) return;
+
+  fprintf(f, "# TYPE baya_frames_total counter\n");
+  fprintf(f, "baya_frames_total %llu\n", (unsigned long long)t->frames);
+  fprintf(f, "# TYPE baya_instructions_total counter\n");
+  fprintf(f, "baya_instructions_total %llu\n",
+          (unsigned long long)t->instructions);
+  fprintf(f, "# TYPE baya_sprites_total counter\n");
+  fprintf(f, "baya_sprites_total %llu\n", (unsigned long long)t->sprites);
+
+  fprintf(f, "# TYPE baya_phase_seconds summary\n");
+  for (phase_t p = 0; p < PHASE_N; p++) {
+    for (uint8_t i = 0; i < 3; i++)
+      fprintf(f, "baya_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+              PHASE_NAME[p], QUANTILES[i],
+              phase_percentile(t, p, QUANTILES[i]) / 1e9);
+    fprintf(f, "baya_phase_seconds_sum{phase=\"%s\"} %.6f\n", PHASE_NAME[p],
+            t->total_ns[p] / 1e9);
+    fprintf(f, "baya_phase_seconds_count{phase=\"%s\"} %llu\n", PHASE_NAME[p],
+            (unsigned long long)t->frames);
+    fprintf(f, "baya_phase_seconds_max{phase=\"%s\"} %.6f\n", PHASE_NAME[p],
+            t->max_ns[p] / 1e9);
+  }
+
+  fclose(f);
+  rename(tmp, t->metrics);
+}
+
+void add_frame(telemetry_t *t, const uint64_t ns[PHASE_N],
+               uint64_t instructions, uint64_t sprites) {
+  for (phase_t p = 0; p < PHASE_N; p++) {
+    t->last_ns[p] = ns[p];
+    t->total_ns[p] += ns[p];
+    if (ns[p] > t->max_ns[p]) t->max_ns[p] = ns[p];
+    t->hist[p][bucket_of(ns[p])]++;
+  }
+  t->frames++;
+  t->last_instructions = instructions;
+  t->last_sprites = sprites;
+  t->instructions += instructions;
+  t->sprites += sprites;
+
+  if (t->csv)
+    fprintf(t->csv, "%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%llu\n",
+            (unsigned long long)t->frames, ns[PHASE_EXEC] / 1e3,
+            ns[PHASE_UPDATE] / 1e3, ns[PHASE_DRAW] / 1e3,
+            ns[PHASE_PRESENT] / 1e3, ns[PHASE_IDLE] / 1e3,
+            (unsigned long long)instructions, (unsigned long long)sprites);
+
+  // once a second is plenty for anything scraping the file
+  if (t->metrics && t->frames % FPS == 0) write_metrics(t);
+}
+
+void close_telemetry(telemetry_t *t) {
+  if (t->metrics) write_metrics(t);
+  if (t->csv) fclose(t->csv);
+  free(t);
+}
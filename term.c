@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "baya.h"
+
+/* TERMINAL */
+/* a character cell holds two pixels, the upper half block in the top one's */
+/* colour over a background of the bottom one's, and a frame only rewrites */
+/* the cells that changed since the last one */
+
+#define HALF_BLOCK "\xe2\x96\x80" // U+2580
+#define TERM_BUF (64 << 10)       // a frame of every cell changing, and colour
+
+struct term_t {
+  int fd;
+  bool drawn; // prev holds what the terminal shows
+  uint8_t prev[SCREEN_HEIGHT][SCREEN_WIDTH];
+  char buf[TERM_BUF];
+  size_t len;
+};
+
+static void put(term_t *t, const char *s, size_t n) {
+  memcpy(t->buf + t->len, s, n);
+  t->len += n;
+}
+
+static void put_color(term_t *t, uint8_t layer, uint8_t c) {
+  // layer is 38 for the foreground, 48 for the background
+  t->len += snprintf(t->buf + t->len, TERM_BUF - t->len, "\x1b[%u;2;%u;%u;%um",
+                     layer, PALETTE[c].r, PALETTE[c].g, PALETTE[c].b);
+}
+
+static void flush(term_t *t) {
+  // all of a frame in one write, unless the terminal takes it in parts
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < t->len) {
+    n = write(t->fd, t->buf + done, t->len - done);
+    if (n < 0 && errno != EINTR) break;
+    if (n > 0) done += n;
+  }
+  t->len = 0;
+}
+
+term_t *open_term(int fd) {
+  term_t *t = calloc(1, sizeof(term_t));
+
+  t->fd = fd;
+  // clear and hide the cursor, so it doesn't blink over the picture
+  put(t, "\x1b[2J\x1b[?25l", 10);
+  flush(t);
+  return t;
+}
+
+void draw_term(term_t *t, const uint8_t *screen) {
+  const uint8_t(*px)[SCREEN_WIDTH] = (const uint8_t(*)[SCREEN_WIDTH])screen;
+  int fg = -1, bg = -1;
+  int at_row = -1, at_col = -1; // where the cursor is, if known
+  uint8_t top, bottom;
+
+  for (uint8_t row = 0; row < SCREEN_HEIGHT / 2; row++)
+    for (uint8_t col = 0; col < SCREEN_WIDTH; col++) {
+      top = px[2 * row][col];
+      bottom = px[2 * row + 1][col];
+      if (t->drawn && top == t->prev[2 * row][col] &&
+          bottom == t->prev[2 * row + 1][col])
+        continue;
+
+      if (row != at_row || col != at_col)
+        t->len += snprintf(t->buf + t->len, TERM_BUF - t->len, "\x1b[%u;%uH",
+                           row + 1, col + 1);
+      if (top != fg) put_color(t, 38, fg = top);
+      if (bottom != bg) put_color(t, 48, bg = bottom);
+      put(t, HALF_BLOCK, 3);
+      at_row = row;
+      at_col = col + 1;
+    }
+
+  if (t->len) {
+    put(t, "\x1b[0m", 4);
+    flush(t);
+  }
+  memcpy(t->prev, screen, sizeof(t->prev));
+  t->drawn = true;
+}
+
+void close_term(term_t *t) {
+  // leave the cursor under the picture, visible again
+  t->len += snprintf(t->buf, TERM_BUF, "\x1b[0m\x1b[%u;1H\x1b[?25h",
+                     SCREEN_HEIGHT / 2 + 1);
+  flush(t);
+  free(t);
+}
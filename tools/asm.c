@@ -0,0 +1,162 @@
+// baya-asm: assemble carts in bulk, on every core
+//
+//   cc -O2 tools/asm.c baya.c -lpthread -o baya-asm
+//   ./baya-asm [-threads N] [-o DIR] [-report FILE] carts/ more.baya ...
+//
+// Directories are searched for .baya files. Each cart that assembles is
+// written next to its source, or into DIR, as a .bayac of the bytes it
+// uses. The diagnostics of every cart come out in one report, in the order
+// the carts were given, then a count of failures.
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../baya.h"
+
+#define ASM_THREADS_MAX 256
+
+typedef struct {
+  char *path;
+  char *report; // its diagnostics, formatted
+  size_t report_len;
+  bool ok;
+} job_t;
+
+static job_t *jobs;
+static uint32_t job_n, job_cap;
+static _Atomic uint32_t next_job;
+static const char *out_dir;
+
+static void add_job(const char *path) {
+  if (job_n == job_cap) {
+    job_cap = job_cap ? job_cap * 2 : 256;
+    jobs = realloc(jobs, job_cap * sizeof(job_t));
+  }
+  jobs[job_n++] = (job_t){strdup(path), NULL, 0, false};
+}
+
+static int by_path(const void *a, const void *b) {
+  return strcmp(((const job_t *)a)->path, ((const job_t *)b)->path);
+}
+
+static void add_dir(const char *dir) {
+  // sorted, so the report comes out the same every time
+  uint32_t first = job_n;
+  char path[4096];
+  struct dirent *d;
+  size_t len;
+  DIR *dp;
+
+  if ((dp = opendir(dir)) == NULL) {
+    fprintf(stderr, "couldn't open %s\n", dir);
+    exit(1);
+  }
+  while ((d = readdir(dp))) {
+    len = strlen(d->d_name);
+    if (len <= 5 || strcmp(d->d_name + len - 5, ".baya") != 0) continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+    add_job(path);
+  }
+  closedir(dp);
+  qsort(jobs + first, job_n - first, sizeof(job_t), by_path);
+}
+
+static bool write_image(const char *src, const cart_t *cart) {
+  // x.baya to x.bayac, in out_dir if there is one
+  const char *base = strrchr(src, '/');
+  char path[4096];
+  FILE *f;
+  bool ok;
+
+  if (out_dir)
+    snprintf(path, sizeof(path), "%s/%sc", out_dir, base ? base + 1 : src);
+  else
+    snprintf(path, sizeof(path), "%sc", src);
+  if ((f = fopen(path, "wb")) == NULL) return false;
+  ok = fwrite(cart->image, 1, cart->size, f) == cart->size;
+  ok &= fclose(f) == 0;
+  return ok;
+}
+
+static void run_job(job_t *j, cart_t *cart) {
+  size_t len;
+  char *text = read_source(j->path, &len);
+  FILE *report = open_memstream(&j->report, &j->report_len);
+
+  if (text == NULL)
+    fprintf(report, "%s: couldn't open\n", j->path);
+  else {
+    j->ok = baya_assemble(text, len, cart);
+    if (cart->diag_n) {
+      fprintf(report, "%s:\n", j->path);
+      print_diags(report, cart->diags, cart->diag_n);
+    }
+    if (j->ok && !(j->ok = write_image(j->path, cart)))
+      fprintf(report, "%s: couldn't write its image\n", j->path);
+  }
+  free(text);
+  fclose(report);
+}
+
+static void *asm_worker(void *arg) {
+  cart_t *cart = malloc(sizeof(cart_t));
+  uint32_t i;
+
+  (void)arg;
+  while ((i = atomic_fetch_add(&next_job, 1)) < job_n) run_job(&jobs[i], cart);
+  free(cart);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t workers[ASM_THREADS_MAX];
+  FILE *report = stderr;
+  uint32_t failed = 0;
+  struct stat st;
+  uint64_t t0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+      threads = atol(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      out_dir = argv[++i];
+    else if (strcmp(argv[i], "-report") == 0 && i + 1 < argc) {
+      if ((report = fopen(argv[++i], "w")) == NULL) {
+        fprintf(stderr, "couldn't open %s\n", argv[i]);
+        return 1;
+      }
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: baya-asm [-threads N] [-o DIR] [-report FILE] "
+                      "cart.baya|DIR ...\n");
+      return 1;
+    } else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+      add_dir(argv[i]);
+    else
+      add_job(argv[i]);
+  }
+
+  if (threads < 1) threads = 1;
+  if (threads > ASM_THREADS_MAX) threads = ASM_THREADS_MAX;
+  if (threads > job_n) threads = job_n ? job_n : 1;
+
+  t0 = now_ns();
+  for (long i = 0; i < threads; i++)
+    pthread_create(&workers[i], NULL, asm_worker, NULL);
+  for (long i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+
+  for (uint32_t i = 0; i < job_n; i++) {
+    fwrite(jobs[i].report, 1, jobs[i].report_len, report);
+    failed += !jobs[i].ok;
+    free(jobs[i].report);
+    free(jobs[i].path);
+  }
+  fprintf(report, "%u carts, %u failed, in %.3f s on %ld threads\n", job_n,
+          failed, (now_ns() - t0) / 1e9, threads);
+  if (report != stderr) fclose(report);
+  free(jobs);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,360 @@
+// baya-bench: microbenchmarks for the vm, renderer and assembler
+//
+//   ./bench.sh [cart.baya ...] > bench.json
+//
+// Every benchmark is calibrated to run for at least BENCH_MIN_NS, warmed up,
+// then repeated; the json gives the median and spread in ns per operation.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../baya.h"
+
+#define BENCH_MIN_NS 20000000
+#define BENCH_WARMUP 2
+#define BENCH_REPS 11
+
+// code stops short of the top of memory, where save puts the stack
+#define BENCH_CODE (MEMORY_SIZE - 32)
+#define BENCH_LINES 720
+
+typedef struct {
+  char name[64];
+  void (*run)(void *ctx);
+  void *ctx;
+  uint64_t ops;          // per run
+  uint64_t instructions; // per run, when known
+} bench_t;
+
+/* RUNNER */
+
+static bool first = true;
+
+static double measure(const bench_t *b, uint64_t runs) {
+  uint64_t t0 = now_ns();
+  for (uint64_t i = 0; i < runs; i++) b->run(b->ctx);
+  return now_ns() - t0;
+}
+
+static int by_value(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void run_bench(const bench_t *b) {
+  double ns[BENCH_REPS];
+  uint64_t runs = 1;
+  double median;
+
+  while (measure(b, runs) < BENCH_MIN_NS) runs *= 2;
+  for (int i = 0; i < BENCH_WARMUP; i++) measure(b, runs);
+  for (int i = 0; i < BENCH_REPS; i++)
+    ns[i] = measure(b, runs) / (runs * b->ops);
+  qsort(ns, BENCH_REPS, sizeof(double), by_value);
+  median = ns[BENCH_REPS / 2];
+
+  printf("%s\n    {\"name\": \"%s\", \"ops\": %llu, \"reps\": %d, "
+         "\"ns_per_op\": %.3f, \"min\": %.3f, \"max\": %.3f, "
+         "\"ops_per_sec\": %.0f",
+         first ? "" : ",", b->name,
+         (unsigned long long)(runs * b->ops), BENCH_REPS, median, ns[0],
+         ns[BENCH_REPS - 1], 1e9 / median);
+  if (b->instructions)
+    printf(", \"instructions_per_sec\": %.0f",
+           1e9 / median * b->instructions / b->ops);
+  printf("}");
+  fflush(stdout);
+  first = false;
+}
+
+/* INSTRUCTIONS */
+/* memory full of one instruction (and the one an if guards) then halt */
+
+static printer_t *printing; // print goes here rather than to stdio when set
+
+static void run_image(void *ctx) {
+  vm_t *vm = ctx;
+  vm->pc = 0;
+  exec(vm);
+}
+
+static void bench_image(const char *name, const uint8_t *ins,
+                        const uint8_t *next) {
+  static vm_t vm;
+  uint8_t image[MEMORY_SIZE] = {0};
+  bench_t b = {{0}, run_image, &vm, 0, 0};
+  uint16_t at = 0;
+
+  while (at + 4 * (next ? 2 : 1) <= BENCH_CODE - 4) {
+    memcpy(image + at, ins, 4);
+    at += 4;
+    b.ops++;
+    if (next) {
+      memcpy(image + at, next, 4);
+      at += 4;
+    }
+  }
+  image[at] = HALT;
+
+  init_vm(&vm, image);
+  vm.out = fopen("/dev/null", "w");
+  if (printing) vm.print = open_print(printing, 0);
+  vm.regs[RX - 1] = 7;
+  vm.regs[RY - 1] = 3;
+
+  snprintf(b.name, sizeof(b.name), "%s", name);
+  run_bench(&b);
+  fclose(vm.out);
+}
+
+static void bench_instructions() {
+  const char *op[] = {"", "set", "add", "sub", "mul", "div",
+                      "mod", "and", "or", "xor"};
+  const char *cmp[] = {"", "eq", "ne", "lt", "le", "gt", "ge"};
+  const uint8_t add_z[] = {REG_ADD_LIT, RZ, 0, 1};
+  char name[64];
+  uint8_t ins[4];
+
+  for (uint8_t o = SET; o <= XOR; o++) {
+    snprintf(name, sizeof(name), "reg_op_reg/%s", op[o]);
+    memcpy(ins, (uint8_t[]){REG_OP_REG, o, RX, RY}, 4);
+    bench_image(name, ins, NULL);
+  }
+  bench_image("reg_set_lit", (uint8_t[]){REG_SET_LIT, RX, 2, 10}, NULL);
+  bench_image("reg_add_lit", (uint8_t[]){REG_ADD_LIT, RX, 0, 1}, NULL);
+  bench_image("reg_random", (uint8_t[]){REG_RANDOM, RX, 6, 4}, NULL);
+
+  for (uint8_t c = EQ; c <= GE; c++) {
+    snprintf(name, sizeof(name), "if_reg_cmp_reg/%s", cmp[c]);
+    memcpy(ins, (uint8_t[]){IF_REG_CMP_REG, c, RX, RY}, 4);
+    bench_image(name, ins, add_z);
+  }
+  bench_image("if_reg_eq_lit", (uint8_t[]){IF_REG_EQ_LIT, RX, 0, 7}, add_z);
+  bench_image("if_reg_ne_lit", (uint8_t[]){IF_REG_NE_LIT, RX, 0, 7}, add_z);
+  bench_image("if_key", (uint8_t[]){IF_KEY, KACTION, 0, 0}, add_z);
+
+  bench_image("point", (uint8_t[]){POINT, 0, 0, 0}, NULL);
+  bench_image("sprite", (uint8_t[]){SPRITE, RX, RY, 5}, NULL);
+  bench_image("clear", (uint8_t[]){CLEAR, 3, 0, 0}, NULL);
+  bench_image("save_load", (uint8_t[]){SAVE, 0, 0, 0},
+              (uint8_t[]){LOAD, 0, 0, 0});
+}
+
+static void bench_print() {
+  // formatted on the vm's thread, then as records a printer formats
+  const uint8_t print[] = {PRINT, RX, 0, 0};
+  FILE *null = fopen("/dev/null", "w");
+
+  bench_image("print/stdio", print, NULL);
+  printing = open_printer(null, PRINT_LINES, 0);
+  bench_image("print/lines", print, NULL);
+  close_printer(printing);
+  printing = open_printer(null, PRINT_BINARY, 0);
+  bench_image("print/binary", print, NULL);
+  close_printer(printing);
+  printing = NULL;
+  fclose(null);
+}
+
+/* ASSEMBLER */
+
+static void write_source(FILE *f) {
+  // every statement form, BENCH_LINES of them, just under 4 kB assembled
+  const char *regs = "xyzwabcdef";
+
+  fprintf(f, "goto main\n: data\n");
+  for (int i = 0; i < 16; i++)
+    fprintf(f, "write 0b_%d0%d1_0110\n", i & 1, i % 3 & 1);
+  fprintf(f, "alias a left\nalias b right ( two aliases )\n: main\n");
+
+  for (int i = 0; i < BENCH_LINES; i++) {
+    char r = regs[i % 10];
+    char s = regs[(i * 7 + 3) % 10];
+
+    switch (i % 16) {
+    case 0:
+      fprintf(f, ": l%d\n", i);
+      break;
+    case 1:
+      fprintf(f, "%c = 0x%02x\n", r, i & 0xff);
+      break;
+    case 2:
+      fprintf(f, "%c += %c\n", r, s);
+      break;
+    case 3:
+      fprintf(f, "if %c < %c then %c += -1\n", r, s, r);
+      break;
+    case 4:
+      fprintf(f, "if left == %d then goto l%d\n", i & 0xff, i - 4);
+      break;
+    case 5:
+      fprintf(f, "key action then right = random 8\n");
+      break;
+    case 6:
+      fprintf(f, "point data sprite %c %c %d\n", r, s, i & 7);
+      break;
+    case 7:
+      fprintf(f, "save %c ^= %c load\n", r, s);
+      break;
+    default:
+      fprintf(f, "%c %%= %c ( comment %d )\n", r, s, i);
+      break;
+    }
+  }
+}
+
+static void run_assembler(void *ctx) { read_file(ctx); }
+
+static void bench_assembler() {
+  static char path[] = "/tmp/baya-bench-XXXXXX";
+  int fd = mkstemp(path);
+  FILE *f = fdopen(fd, "w");
+  bench_t b = {"assembler/synthetic", run_assembler, path, BENCH_LINES, 0};
+
+  write_source(f);
+  fclose(f);
+  run_bench(&b);
+  unlink(path);
+}
+
+/* CARTS */
+
+typedef struct {
+  vm_t vm;
+  uint8_t start[SNAPSHOT_SIZE];
+} cart_run_t;
+
+static void run_cart(void *ctx) {
+  // a minute of play from power on
+  cart_run_t *c = ctx;
+  baya_restore(&c->vm, c->start);
+  for (int i = 0; i < FPS * 60; i++) run_frame(&c->vm);
+}
+
+static void bench_cart(char *cart) {
+  static cart_run_t c;
+  static profile_t profile;
+  bench_t b = {{0}, run_cart, &c, FPS * 60, 0};
+
+  read_file(cart);
+  init_vm(&c.vm, mem);
+  c.vm.out = fopen("/dev/null", "w");
+  baya_snapshot(&c.vm, c.start);
+
+  // count the instructions once, then time the plain interpreter
+  memset(&profile, 0, sizeof(profile));
+  c.vm.profile = &profile;
+  run_cart(&c);
+  c.vm.profile = NULL;
+  for (int o = 0; o < 256; o++) b.instructions += profile.ops[o];
+
+  snprintf(b.name, sizeof(b.name), "cart/%s", cart);
+  run_bench(&b);
+  fclose(c.vm.out);
+}
+
+/* BATCH */
+
+#define BENCH_LANES 256
+
+typedef struct {
+  batch_t *b;
+  vm_t start;
+} batch_run_t;
+
+static void run_batch(void *ctx) {
+  // a minute of play on every lane, each with its own seed and buttons
+  batch_run_t *c = ctx;
+
+  for (uint32_t l = 0; l < BENCH_LANES; l++) {
+    put_lane(c->b, l, &c->start);
+    seed_lane(c->b, l, l + 1);
+  }
+  for (int i = 0; i < FPS * 60; i++) {
+    for (uint32_t l = 0; l < BENCH_LANES; l++)
+      set_lane_keys(c->b, l, (i / FPS + l) * 2654435761u >> 27);
+    run_batch_frame(c->b);
+  }
+}
+
+static void bench_batch(char *cart) {
+  static batch_run_t c;
+  bench_t b = {{0}, run_batch, &c, FPS * 60 * BENCH_LANES, 0};
+
+  read_file(cart);
+  init_vm(&c.start, mem);
+  c.b = open_batch(mem, pc, BENCH_LANES);
+
+  // ns per frame of one lane, to set against cart/
+  snprintf(b.name, sizeof(b.name), "batch/%s", cart);
+  run_bench(&b);
+  close_batch(c.b);
+}
+
+/* FARM */
+
+typedef struct {
+  farm_t *f;
+  vm_t start;
+  vm_t vm[BENCH_LANES];
+  task_t task[BENCH_LANES];
+} farm_run_t;
+
+static void run_farm(void *ctx) {
+  // instances from a second to a minute long, so workers must steal to
+  // finish together
+  farm_run_t *c = ctx;
+
+  for (uint32_t l = 0; l < BENCH_LANES; l++) {
+    c->vm[l] = c->start;
+    seed_random(&c->vm[l], l + 1);
+    c->task[l].vm = &c->vm[l];
+    c->task[l].frames = FPS * (1 + l * 7 % 60);
+    submit_task(c->f, &c->task[l]);
+  }
+  wait_farm(c->f);
+}
+
+static void bench_farm(char *cart) {
+  static farm_run_t c;
+  bench_t b = {{0}, run_farm, &c, 0, 0};
+
+  read_file(cart);
+  init_vm(&c.start, mem);
+  c.start.out = NULL;
+  c.f = open_farm(0);
+  for (uint32_t l = 0; l < BENCH_LANES; l++)
+    b.ops += FPS * (1 + l * 7 % 60);
+
+  // ns per frame of one instance, with the workers' share on stderr
+  snprintf(b.name, sizeof(b.name), "farm/%s", cart);
+  run_bench(&b);
+  report_farm(c.f, stderr);
+  close_farm(c.f);
+}
+
+/* MAIN */
+
+int main(int argc, char **argv) {
+  printf("{\n  \"fps\": %d,\n  \"unit\": \"ns\",\n  \"benchmarks\": [", FPS);
+
+  bench_instructions();
+  bench_print();
+  bench_assembler();
+
+  if (argc < 2) {
+    bench_cart("game.baya");
+    bench_batch("game.baya");
+    bench_farm("game.baya");
+  } else
+    for (int i = 1; i < argc; i++) {
+      bench_cart(argv[i]);
+      bench_batch(argv[i]);
+      bench_farm(argv[i]);
+    }
+
+  printf("\n  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,94 @@
+// libFuzzer entry points for the assembler and the vm
+//
+//   CFLAGS="-g -O1 -fsanitize=fuzzer,address,undefined"
+//   clang $CFLAGS tools/fuzz.c baya.c -o fuzz-asm
+//   clang $CFLAGS -DFUZZ_VM -DBAYA_CHECKED tools/fuzz.c baya.c -o fuzz-vm
+//   ./fuzz-asm -dict=tools/baya.dict corpus/
+//
+// Without libFuzzer, -DFUZZ_STANDALONE builds a main that runs each file
+// given once, to replay a crash with any compiler:
+//
+//   cc -g -fsanitize=address,undefined -DFUZZ_STANDALONE tools/fuzz.c baya.c
+//
+// The vm target wants the checked build, or it only finds what the checks
+// are there for.
+//   ./a.out crash-...
+//
+// Neither entry point touches a file, exits or keeps anything between runs:
+// assemble resets the assembler itself and the vm lives on the stack.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../baya.h"
+
+#define FUZZ_FRAMES 8
+#define FUZZ_BUDGET (1 << 16) // instructions over all frames
+
+#ifndef FUZZ_VM
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  // any text as a cart, then everything it produced back to source
+  char text[64];
+
+  if (!assemble((const char *)data, size)) return 0;
+
+  for (uint16_t i = 0; i + 4 <= pc; i += 4)
+    disassemble(&mem[i], text, sizeof(text));
+  for (uint16_t i = 0; i < pc; i++) label_before(i);
+  return 0;
+}
+
+#else
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  // any bytes as a memory image, the rest of it zero, under a budget
+  uint8_t image[MEMORY_SIZE] = {0};
+  vm_t vm;
+
+  memcpy(image, data, size < MEMORY_SIZE ? size : MEMORY_SIZE);
+  init_vm(&vm, image);
+  vm.out = NULL;
+  vm.budget = FUZZ_BUDGET;
+
+  for (uint8_t f = 0; f < FUZZ_FRAMES && vm.budget && !vm.fault; f++) {
+    // buttons come from the input too, so if key branches both ways
+    vm.keys = size ? data[f % size] : 0;
+    exec_budgeted(&vm);
+    vm.pc = 0;
+    vm.regs[RT - 1]++;
+  }
+  return 0;
+}
+
+#endif
+
+#ifdef FUZZ_STANDALONE
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+  FILE *f;
+  uint8_t *buf;
+  long n;
+
+  for (int i = 1; i < argc; i++) {
+    if ((f = fopen(argv[i], "rb")) == NULL) {
+      fprintf(stderr, "couldn't open %s\n", argv[i]);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    rewind(f);
+    buf = malloc(n ? n : 1);
+    n = fread(buf, 1, n, f);
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(buf, n);
+    free(buf);
+    fprintf(stderr, "ran %s\n", argv[i]);
+  }
+  return 0;
+}
+
+#endif
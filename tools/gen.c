@@ -0,0 +1,318 @@
+// baya-gen: write a random but valid cart of a given shape and size
+//
+//   cc tools/gen.c -o baya-gen
+//   ./baya-gen -shape branch -size 4000 -seed 7 > branch.baya
+//
+// Every frame of a generated cart halts: jumps go forward, and the only
+// backward jumps close loops with a fixed trip count.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMORY_SIZE (1 << 12)
+#define LABEL_MAX 64
+#define SPRITES 8
+#define STACK_FRAME 9 // bytes a save takes
+
+typedef enum {
+  UNIT_ARITH,
+  UNIT_BRANCH,
+  UNIT_SPRITE,
+  UNIT_LOOP,
+  UNIT_STACK,
+  UNIT_LABEL,
+  UNIT_N,
+} unit_t;
+
+typedef struct {
+  const char *name;
+  uint8_t weight[UNIT_N]; // arith, branch, sprite, loop, stack, label
+} shape_t;
+
+const shape_t SHAPES[] = {
+    {"mixed", {4, 3, 2, 1, 1, 1}},  {"arith", {12, 1, 0, 1, 0, 0}},
+    {"branch", {2, 10, 0, 3, 0, 1}}, {"sprite", {1, 1, 10, 1, 0, 0}},
+    {"labels", {2, 2, 1, 0, 0, 10}}, {"stack", {2, 1, 0, 0, 8, 0}},
+};
+
+// registers x y z w a b c d are free for anything, e counts loops and f
+// is kept nonzero to divide by
+const char *REGS[] = {"x", "y", "z", "w", "a", "b", "c", "d"};
+const char *ALIAS[] = {"px", "py", "vx", "vy", "tmp", "acc", "col", "row"};
+const char *OPS[] = {"=", "+=", "-=", "*=", "&=", "|=", "^="};
+const char *CMPS[] = {"==", "!=", "<", "<=", ">", ">="};
+const char *KEYS[] = {"action", "up", "down", "left", "right"};
+
+uint32_t rng;
+uint16_t used;   // bytes of code and data so far
+uint16_t budget; // bytes allowed
+uint8_t labels;  // labels defined so far
+uint16_t next_label;
+uint8_t stack_depth = 4;
+
+uint32_t next() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+uint32_t below(uint32_t n) { return next() % n; }
+
+const char *reg() {
+  // aliased registers are sometimes used by alias
+  uint8_t r = below(8);
+  return below(3) == 0 ? ALIAS[r] : REGS[r];
+}
+
+void literal(char *out, size_t n) {
+  // decimal, hex, binary with separators and negatives, all in 0..255
+  uint8_t v = below(256);
+
+  switch (below(4)) {
+  case 0:
+    snprintf(out, n, "%u", v);
+    break;
+  case 1:
+    snprintf(out, n, "0x%02x", v);
+    break;
+  case 2:
+    snprintf(out, n, "0b_%u%u%u%u_%u%u%u%u", v >> 7 & 1, v >> 6 & 1,
+             v >> 5 & 1, v >> 4 & 1, v >> 3 & 1, v >> 2 & 1, v >> 1 & 1,
+             v & 1);
+    break;
+  default:
+    snprintf(out, n, "-%u", v % 128);
+    break;
+  }
+}
+
+bool fits(uint16_t bytes) { return used + bytes <= budget; }
+
+void ins(uint16_t n) { used += 4 * n; }
+
+/* UNITS */
+/* each returns false, writing nothing, when it doesn't fit */
+
+bool arith(uint8_t n) {
+  char lit[32];
+
+  if (!fits(4 * 3 * n)) return false;
+
+  for (uint8_t i = 0; i < n; i++) {
+    switch (below(6)) {
+    case 0:
+      literal(lit, sizeof(lit));
+      printf("%s = %s\n", reg(), lit);
+      ins(1);
+      break;
+    case 1:
+      literal(lit, sizeof(lit));
+      printf("%s += %s\n", reg(), lit);
+      ins(1);
+      break;
+    case 2:
+      printf("%s = random %u\n", reg(), 1 + below(255));
+      ins(1);
+      break;
+    case 3:
+      // f is never zero here
+      printf("if f == 0 then f = 1\n%s %s f\n", reg(),
+             below(2) ? "/=" : "%=");
+      ins(3);
+      break;
+    default:
+      printf("%s %s %s\n", reg(), OPS[below(7)], reg());
+      ins(1);
+      break;
+    }
+  }
+  return true;
+}
+
+bool branch(uint8_t n) {
+  char lit[32];
+
+  if (!fits(4 * 5 * n) || labels == LABEL_MAX - 1) return false;
+
+  // everything jumps forward to one label at the end
+  for (uint8_t i = 0; i < n; i++) {
+    switch (below(4)) {
+    case 0:
+      printf("if %s %s %s then goto l%u\n", reg(), CMPS[below(6)], reg(),
+             next_label);
+      break;
+    case 1:
+      literal(lit, sizeof(lit));
+      printf("if %s %s %s then goto l%u\n", reg(), below(2) ? "==" : "!=",
+             lit, next_label);
+      break;
+    case 2:
+      printf("key %s then goto l%u\n", KEYS[below(5)], next_label);
+      break;
+    default:
+      printf("if t %s %s then %s += 1\n", CMPS[below(6)], reg(), reg());
+      break;
+    }
+    ins(2);
+    arith(1);
+  }
+  printf(": l%u\n", next_label++);
+  labels++;
+  return true;
+}
+
+bool sprite(uint8_t n) {
+  if (!fits(4 * 5 * n)) return false;
+
+  for (uint8_t i = 0; i < n; i++) {
+    printf("point s%u\nx = random 64\ny = random 32\nsprite x y %u\n",
+           below(SPRITES), below(8));
+    ins(4);
+    if (below(4) == 0) {
+      printf("clear %u\n", below(8));
+      ins(1);
+    }
+  }
+  return true;
+}
+
+bool loop(uint8_t n) {
+  // e counts up to a fixed number, and nothing else touches it
+  uint16_t body = 4 * 3 * n + 4 * 5;
+
+  if (!fits(body) || labels == LABEL_MAX - 1) return false;
+
+  printf("e = 0\n: l%u ( loop )\n", next_label);
+  ins(1);
+  arith(n);
+  printf("e += 1\nif e != %u then goto l%u\n", 2 + below(14), next_label);
+  ins(3);
+
+  next_label++;
+  labels++;
+  return true;
+}
+
+bool stack(uint8_t n) {
+  if (!fits(4 * 5 * n)) return false;
+
+  for (uint8_t i = 0; i < n; i++) {
+    printf("save\n");
+    arith(1);
+    ins(1);
+  }
+  for (uint8_t i = 0; i < n; i++) {
+    printf("load\n");
+    ins(1);
+  }
+  return true;
+}
+
+bool label() {
+  if (labels == LABEL_MAX - 1) return false;
+
+  printf(": l%u\n", next_label++);
+  labels++;
+  return arith(1);
+}
+
+/* MAIN */
+
+void usage() {
+  fprintf(stderr, "usage: baya-gen [-shape");
+  for (size_t i = 0; i < sizeof(SHAPES) / sizeof(SHAPES[0]); i++)
+    fprintf(stderr, "%s%s", i ? "|" : " ", SHAPES[i].name);
+  fprintf(stderr, "] [-size BYTES] [-depth N] [-seed N]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const shape_t *shape = &SHAPES[0];
+  uint32_t size = MEMORY_SIZE;
+  uint32_t seed = 1;
+  uint16_t total = 0;
+  uint16_t pick;
+  unit_t u;
+  bool ok;
+  int misses = 0;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-shape") == 0) {
+      shape = NULL;
+      for (size_t s = 0; s < sizeof(SHAPES) / sizeof(SHAPES[0]); s++)
+        if (strcmp(argv[i + 1], SHAPES[s].name) == 0) shape = &SHAPES[s];
+      if (shape == NULL) usage();
+    } else if (strcmp(argv[i], "-size") == 0)
+      size = strtoul(argv[i + 1], NULL, 0);
+    else if (strcmp(argv[i], "-depth") == 0)
+      stack_depth = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-seed") == 0)
+      seed = strtoul(argv[i + 1], NULL, 0);
+    else
+      usage();
+  }
+  if (argc % 2 == 0) usage();
+
+  rng = seed ? seed : 1;
+  for (u = 0; u < UNIT_N; u++) total += shape->weight[u];
+
+  // leave room for the final halt and, below the top byte, the deepest stack
+  if (size > MEMORY_SIZE) size = MEMORY_SIZE;
+  budget = size - 4;
+  if (shape->weight[UNIT_STACK] &&
+      budget > MEMORY_SIZE - 5 - STACK_FRAME * stack_depth)
+    budget = MEMORY_SIZE - 5 - STACK_FRAME * stack_depth;
+
+  printf("( generated by baya-gen -shape %s -size %u -seed %u )\n\n",
+         shape->name, size, seed);
+  printf("goto main\n\n");
+  ins(1);
+
+  for (uint8_t s = 0; s < SPRITES; s++) {
+    printf(": s%u\n", s);
+    for (uint8_t row = 0; row < 4; row++) printf("write 0x%02x\n", below(256));
+    used += 4;
+  }
+  labels = SPRITES;
+
+  printf("\n");
+  for (uint8_t r = 0; r < 8; r++) printf("alias %s %s\n", REGS[r], ALIAS[r]);
+  printf("\n: main\nf = 7\nif t == 0 then print f\nclear 0\n");
+  labels++;
+  ins(4);
+
+  while (misses < 64) {
+    pick = below(total);
+    for (u = 0; pick >= shape->weight[u]; u++) pick -= shape->weight[u];
+
+    switch (u) {
+    case UNIT_ARITH:
+      ok = arith(1 + below(4));
+      break;
+    case UNIT_BRANCH:
+      ok = branch(1 + below(4));
+      break;
+    case UNIT_SPRITE:
+      ok = sprite(1 + below(2));
+      break;
+    case UNIT_LOOP:
+      ok = loop(1 + below(3));
+      break;
+    case UNIT_STACK:
+      ok = stack(1 + below(stack_depth));
+      break;
+    default:
+      ok = label();
+      break;
+    }
+    // near the end only small units still fit
+    misses = ok ? 0 : misses + 1;
+  }
+
+  fprintf(stderr, "%u bytes, %u labels\n", used + 4, labels);
+  return 0;
+}
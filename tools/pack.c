@@ -0,0 +1,92 @@
+// baya-pack: assemble a directory of carts into one library
+//
+//   cc tools/pack.c baya.c library.c -o baya-pack
+//   ./baya-pack [-lz4] carts/ carts.bayalib
+//
+// A cart is named after its file, without the .baya. Any cart that fails to
+// assemble stops the pack, after every other one has been tried.
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../baya.h"
+
+static int by_name(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int main(int argc, char **argv) {
+  uint32_t flags = 0;
+  char **files = NULL;
+  uint32_t n = 0, cap = 0;
+  char (*names)[LIBRARY_NAME];
+  cart_t *carts;
+  char path[4096];
+  struct dirent *d;
+  size_t len, src_len;
+  char *text;
+  bool ok = true;
+  DIR *dir;
+
+  if (argc == 4 && strcmp(argv[1], "-lz4") == 0) {
+    flags |= LIBRARY_LZ4;
+    argv++;
+    argc--;
+  }
+  if (argc != 3) {
+    fprintf(stderr, "usage: baya-pack [-lz4] DIR OUT\n");
+    return 1;
+  }
+  if ((dir = opendir(argv[1])) == NULL) {
+    fprintf(stderr, "couldn't open %s\n", argv[1]);
+    return 1;
+  }
+
+  while ((d = readdir(dir))) {
+    len = strlen(d->d_name);
+    if (len <= 5 || strcmp(d->d_name + len - 5, ".baya") != 0) continue;
+    if (len - 5 >= LIBRARY_NAME) {
+      fprintf(stderr, "%s: name too long\n", d->d_name);
+      ok = false;
+      continue;
+    }
+    if (n == cap)
+      files = realloc(files, (cap = cap ? cap * 2 : 64) * sizeof(char *));
+    files[n++] = strdup(d->d_name);
+  }
+  closedir(dir);
+  // sorted so diagnostics come out in the same order every time
+  qsort(files, n, sizeof(char *), by_name);
+
+  names = calloc(n, LIBRARY_NAME);
+  carts = calloc(n, sizeof(cart_t));
+  for (uint32_t i = 0; i < n; i++) {
+    memcpy(names[i], files[i], strlen(files[i]) - 5);
+    snprintf(path, sizeof(path), "%s/%s", argv[1], files[i]);
+    if ((text = read_source(path, &src_len)) == NULL) {
+      fprintf(stderr, "%s: couldn't open\n", path);
+      ok = false;
+      continue;
+    }
+    if (!baya_assemble(text, src_len, &carts[i])) ok = false;
+    if (carts[i].diag_n) {
+      fprintf(stderr, "%s:\n", path);
+      print_diags(stderr, carts[i].diags, carts[i].diag_n);
+    }
+    free(text);
+  }
+
+  if (ok && !write_library(argv[2], carts, (const char(*)[LIBRARY_NAME])names,
+                           n, flags)) {
+    fprintf(stderr, "couldn't write %s\n", argv[2]);
+    ok = false;
+  }
+  if (ok) fprintf(stderr, "%u carts in %s\n", n, argv[2]);
+
+  for (uint32_t i = 0; i < n; i++) free(files[i]);
+  free(files);
+  free(names);
+  free(carts);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+// baya-trace: disassemble a trace written by baya -trace
+//
+//   cc tools/trace.c baya.c -o baya-trace
+//   ./baya-trace game.baya trace.bin
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../baya.h"
+
+int main(int argc, char **argv) {
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  char text[64];
+  uint8_t bytes[4];
+  uint32_t r;
+  uint32_t frame = 0;
+  bool start = true;
+  FILE *f;
+  int l;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: baya-trace cart.baya trace.bin\n");
+    return 1;
+  }
+
+  // the cart gives the labels, lines and aliases
+  read_file(argv[1]);
+
+  if ((f = fopen(argv[2], "rb")) == NULL ||
+      fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "%s is not a trace\n", argv[2]);
+    return 1;
+  }
+
+  while (fread(bytes, 1, 4, f) == 4) {
+    r = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+
+    if (start) printf("frame %u\n", frame);
+    start = false;
+
+    // decode the cart's instruction, but with the opcode that ran
+    for (uint8_t i = 0; i < 4; i++)
+      bytes[i] = mem[(TRACE_PC(r) + i) & (MEMORY_SIZE - 1)];
+    bytes[0] = TRACE_OP(r);
+    disassemble(bytes, text, sizeof(text));
+
+    l = label_before(TRACE_PC(r));
+    printf("  0x%03x %5u  %-12s ", TRACE_PC(r), line_at[TRACE_PC(r)],
+           l < 0 ? "" : label[l]);
+    if (TRACE_REG(r) == TRACE_ALL)
+      printf("%-28s  x..f loaded\n", text);
+    else if (TRACE_REG(r))
+      printf("%-28s  %s = %u\n", text, reg_name(TRACE_REG(r)), TRACE_VALUE(r));
+    else
+      printf("%s\n", text);
+
+    if (TRACE_OP(r) == HALT) {
+      frame++;
+      start = true;
+    }
+  }
+
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "baya.h"
+
+#define TRACE_CHUNK 4096 // records encoded between writes
+
+/* TRACE */
+/* the vm appends records to a ring and this thread writes them out, so */
+/* tracing never waits on the disk unless the ring fills up */
+
+static void *flush_trace(void *arg) {
+  const struct timespec nap = {0, 1000000};
+  trace_t *t = arg;
+  uint8_t out[4 * TRACE_CHUNK];
+  uint32_t head, tail, start, n, r;
+  bool stop;
+
+  for (;;) {
+    // stop is read first, so an empty pass after it has seen every record
+    stop = atomic_load(&t->stop);
+    head = atomic_load_explicit(&t->head, memory_order_acquire);
+    tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+
+    if (head == tail) {
+      if (stop) break;
+      nanosleep(&nap, NULL);
+      continue;
+    }
+
+    // the part up to the end of the buffer first, the rest next time
+    start = tail & (TRACE_RING - 1);
+    n = head - tail;
+    if (n > TRACE_RING - start) n = TRACE_RING - start;
+    if (n > TRACE_CHUNK) n = TRACE_CHUNK;
+    for (uint32_t i = 0; i < n; i++) {
+      r = t->buf[start + i];
+      out[4 * i] = r;
+      out[4 * i + 1] = r >> 8;
+      out[4 * i + 2] = r >> 16;
+      out[4 * i + 3] = r >> 24;
+    }
+    fwrite(out, 4, n, t->file);
+
+    atomic_store_explicit(&t->tail, tail + n, memory_order_release);
+  }
+  return NULL;
+}
+
+trace_t *open_trace(const char *path) {
+  trace_t *t = calloc(1, sizeof(trace_t));
+
+  if ((t->file = fopen(path, "wb")) == NULL) {
+    free(t);
+    return NULL;
+  }
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), t->file);
+
+  pthread_create(&t->flusher, NULL, flush_trace, t);
+  return t;
+}
+
+void close_trace(trace_t *t) {
+  atomic_store(&t->stop, true);
+  pthread_join(t->flusher, NULL);
+  fclose(t->file);
+  free(t);
+}
@@ -0,0 +1,639 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "baya.h"
+
+#define VIDEO_SLOTS 16
+#define VIDEO_THREADS_MAX 16
+
+/* FRAME QUEUE */
+/* the vm thread only copies the screen in, workers encode frames in any */
+/* order and a writer thread puts them out in order */
+
+typedef enum { SLOT_FREE, SLOT_FILLED, SLOT_ENCODING, SLOT_DONE } slot_state_t;
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} buf_t;
+
+typedef struct {
+  slot_state_t state;
+  uint32_t frame;
+  uint8_t screen[SCREEN_HEIGHT][SCREEN_WIDTH];
+  uint8_t prev[SCREEN_HEIGHT][SCREEN_WIDTH]; // for frame deltas
+  buf_t out;
+} slot_t;
+
+struct video_t {
+  video_format_t format;
+  const char *path;
+  FILE *file;
+  uint16_t width;
+  uint16_t height;
+  uint8_t scale;
+
+  slot_t slots[VIDEO_SLOTS];
+  uint8_t last[SCREEN_HEIGHT][SCREEN_WIDTH];
+  uint32_t pushed;   // frames handed in
+  uint32_t encoding; // next frame for a worker
+  uint32_t written;  // next frame for the writer
+  bool closing;
+
+  pthread_mutex_t lock;
+  pthread_cond_t filled; // workers wait for frames
+  pthread_cond_t done;   // the writer waits for encoded frames
+  pthread_cond_t freed;  // push_video waits for a slot
+  pthread_t writer;
+  pthread_t workers[VIDEO_THREADS_MAX];
+  uint8_t threads;
+};
+
+/* BUFFER */
+
+static void reserve(buf_t *b, size_t n) {
+  if (b->len + n <= b->cap) return;
+  while (b->len + n > b->cap) b->cap = b->cap ? b->cap * 2 : 4096;
+  b->data = realloc(b->data, b->cap);
+}
+
+static void put_byte(buf_t *b, uint8_t n) {
+  reserve(b, 1);
+  b->data[b->len++] = n;
+}
+
+static void put_bytes(buf_t *b, const void *p, size_t n) {
+  reserve(b, n);
+  memcpy(b->data + b->len, p, n);
+  b->len += n;
+}
+
+static void put_u32_be(buf_t *b, uint32_t n) {
+  put_byte(b, n >> 24);
+  put_byte(b, (n >> 16) & 0xff);
+  put_byte(b, (n >> 8) & 0xff);
+  put_byte(b, n & 0xff);
+}
+
+/* SCALING */
+
+static void scale_row(const video_t *v, const uint8_t *src, uint8_t *dst) {
+  // nearest neighbour, so every pixel becomes a scale x scale block
+  for (uint16_t x = 0; x < v->width; x++) dst[x] = src[x / v->scale];
+}
+
+/* Y4M AND RGB */
+
+static void encode_rgb(const video_t *v, slot_t *s) {
+  uint8_t row[SCREEN_WIDTH * 64];
+  Color c;
+
+  for (uint16_t y = 0; y < v->height; y++) {
+    scale_row(v, s->screen[y / v->scale], row);
+    reserve(&s->out, v->width * 3);
+    for (uint16_t x = 0; x < v->width; x++) {
+      c = PALETTE[row[x]];
+      s->out.data[s->out.len++] = c.r;
+      s->out.data[s->out.len++] = c.g;
+      s->out.data[s->out.len++] = c.b;
+    }
+  }
+}
+
+static void palette_yuv(uint8_t yuv[PALETTE_SIZE][3]) {
+  // bt.601, limited range
+  Color c;
+
+  for (uint8_t i = 0; i < PALETTE_SIZE; i++) {
+    c = PALETTE[i];
+    yuv[i][0] = 16 + (66 * c.r + 129 * c.g + 25 * c.b + 128) / 256;
+    yuv[i][1] = 128 + (-38 * c.r - 74 * c.g + 112 * c.b + 128) / 256;
+    yuv[i][2] = 128 + (112 * c.r - 94 * c.g - 18 * c.b + 128) / 256;
+  }
+}
+
+static void encode_y4m(const video_t *v, slot_t *s) {
+  uint8_t row[SCREEN_WIDTH * 64];
+  uint8_t yuv[PALETTE_SIZE][3];
+  size_t plane = (size_t)v->width * v->height;
+  uint8_t *out;
+
+  palette_yuv(yuv);
+  put_bytes(&s->out, "FRAME\n", 6);
+  reserve(&s->out, plane * 3);
+  out = s->out.data + s->out.len;
+
+  for (uint16_t y = 0; y < v->height; y++) {
+    scale_row(v, s->screen[y / v->scale], row);
+    for (uint16_t x = 0; x < v->width; x++) {
+      out[y * v->width + x] = yuv[row[x]][0];
+      out[plane + y * v->width + x] = yuv[row[x]][1];
+      out[plane * 2 + y * v->width + x] = yuv[row[x]][2];
+    }
+  }
+  s->out.len += plane * 3;
+}
+
+/* PNG */
+
+static uint32_t crc_table[256];
+
+static void init_crc_table() {
+  uint32_t c;
+
+  for (uint32_t n = 0; n < 256; n++) {
+    c = n;
+    for (uint8_t k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crc_table[n] = c;
+  }
+}
+
+static uint32_t crc32(const uint8_t *p, size_t n) {
+  uint32_t c = 0xffffffff;
+  while (n--) c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+  return c ^ 0xffffffff;
+}
+
+static uint32_t adler32(const uint8_t *p, size_t n) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+
+  while (n--) {
+    a = (a + *p++) % 65521;
+    b = (b + a) % 65521;
+  }
+  return b << 16 | a;
+}
+
+typedef struct {
+  buf_t *b;
+  uint32_t bits;
+  uint8_t n;
+} bits_t;
+
+static void put_bits(bits_t *w, uint32_t value, uint8_t n) {
+  w->bits |= value << w->n;
+  w->n += n;
+  while (w->n >= 8) {
+    put_byte(w->b, w->bits & 0xff);
+    w->bits >>= 8;
+    w->n -= 8;
+  }
+}
+
+static void put_code(bits_t *w, uint16_t code, uint8_t n) {
+  // huffman codes go out most significant bit first
+  uint16_t r = 0;
+  for (uint8_t i = 0; i < n; i++) r |= ((code >> i) & 1) << (n - 1 - i);
+  put_bits(w, r, n);
+}
+
+static void put_literal(bits_t *w, uint16_t n) {
+  // the fixed huffman table from rfc 1951
+  if (n < 144)
+    put_code(w, 0x30 + n, 8);
+  else if (n < 256)
+    put_code(w, 0x190 + n - 144, 9);
+  else if (n < 280)
+    put_code(w, n - 256, 7);
+  else
+    put_code(w, 0xc0 + n - 280, 8);
+}
+
+static const uint16_t LENGTH_BASE[] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DIST_BASE[] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,
+    65,  97,  129, 193, 257, 385,  513,  769,  1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DIST_EXTRA[] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                     4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                     9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void put_match(bits_t *w, uint16_t len, uint16_t dist) {
+  uint8_t i = 28;
+  while (LENGTH_BASE[i] > len) i--;
+  put_literal(w, 257 + i);
+  put_bits(w, len - LENGTH_BASE[i], LENGTH_EXTRA[i]);
+
+  i = 29;
+  while (DIST_BASE[i] > dist) i--;
+  put_code(w, i, 5);
+  put_bits(w, dist - DIST_BASE[i], DIST_EXTRA[i]);
+}
+
+static uint16_t match_length(const uint8_t *p, size_t i, size_t n,
+                             size_t dist) {
+  uint16_t len = 0;
+  if (i < dist) return 0;
+  while (len < 258 && i + len < n && p[i + len] == p[i + len - dist]) len++;
+  return len;
+}
+
+static void deflate(buf_t *b, const uint8_t *p, size_t n, size_t stride) {
+  // one fixed huffman block; scaled frames repeat either the pixel to the
+  // left or the row above, so those are the only two distances tried
+  bits_t w = {b, 0, 0};
+  uint16_t left, up;
+  size_t i = 0;
+
+  put_byte(b, 0x78);
+  put_byte(b, 0x01);
+  put_bits(&w, 1, 1); // last block
+  put_bits(&w, 1, 2); // fixed huffman
+
+  while (i < n) {
+    left = match_length(p, i, n, 1);
+    up = match_length(p, i, n, stride);
+
+    if (up >= 3 && up >= left) {
+      put_match(&w, up, stride);
+      i += up;
+    } else if (left >= 3) {
+      put_match(&w, left, 1);
+      i += left;
+    } else {
+      put_literal(&w, p[i++]);
+    }
+  }
+  put_literal(&w, 256);
+  if (w.n) put_bits(&w, 0, 8 - w.n);
+
+  put_u32_be(b, adler32(p, n));
+}
+
+static void put_chunk_end(buf_t *b, size_t start) {
+  // start is where the length goes, the crc covers type and data
+  uint32_t len = b->len - start - 8;
+
+  b->data[start] = len >> 24;
+  b->data[start + 1] = (len >> 16) & 0xff;
+  b->data[start + 2] = (len >> 8) & 0xff;
+  b->data[start + 3] = len & 0xff;
+  put_u32_be(b, crc32(b->data + start + 4, len + 4));
+}
+
+static void encode_png(const video_t *v, slot_t *s) {
+  const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  size_t stride = v->width + 1;
+  uint8_t *raw = malloc(stride * v->height);
+  buf_t *b = &s->out;
+  size_t start;
+
+  for (uint16_t y = 0; y < v->height; y++) {
+    raw[y * stride] = 0; // no filter
+    scale_row(v, s->screen[y / v->scale], raw + y * stride + 1);
+  }
+
+  put_bytes(b, signature, sizeof(signature));
+
+  start = b->len;
+  put_bytes(b, "\0\0\0\0IHDR", 8);
+  put_u32_be(b, v->width);
+  put_u32_be(b, v->height);
+  put_byte(b, 8); // bit depth
+  put_byte(b, 3); // indexed
+  put_byte(b, 0);
+  put_byte(b, 0);
+  put_byte(b, 0);
+  put_chunk_end(b, start);
+
+  start = b->len;
+  put_bytes(b, "\0\0\0\0PLTE", 8);
+  for (uint8_t i = 0; i < PALETTE_SIZE; i++) {
+    put_byte(b, PALETTE[i].r);
+    put_byte(b, PALETTE[i].g);
+    put_byte(b, PALETTE[i].b);
+  }
+  put_chunk_end(b, start);
+
+  start = b->len;
+  put_bytes(b, "\0\0\0\0IDAT", 8);
+  deflate(b, raw, stride * v->height, stride);
+  put_chunk_end(b, start);
+
+  start = b->len;
+  put_bytes(b, "\0\0\0\0IEND", 8);
+  put_chunk_end(b, start);
+
+  free(raw);
+}
+
+/* GIF */
+/* the palette is the global color table, so there is nothing to quantise */
+/* and lzw works on 3 bit codes */
+
+#define GIF_CODE_MIN 3
+#define GIF_CLEAR (1 << GIF_CODE_MIN)
+#define GIF_END (GIF_CLEAR + 1)
+#define GIF_CODES 4096
+
+static void put_u16_le(buf_t *b, uint16_t n) {
+  put_byte(b, n & 0xff);
+  put_byte(b, n >> 8);
+}
+
+static void gif_header(buf_t *b, uint16_t width, uint16_t height) {
+  put_bytes(b, "GIF89a", 6);
+  put_u16_le(b, width);
+  put_u16_le(b, height);
+  put_byte(b, 0x80 | (GIF_CODE_MIN - 1) << 4 | (GIF_CODE_MIN - 1));
+  put_byte(b, 0); // background
+  put_byte(b, 0); // aspect
+  for (uint8_t i = 0; i < PALETTE_SIZE; i++) {
+    put_byte(b, PALETTE[i].r);
+    put_byte(b, PALETTE[i].g);
+    put_byte(b, PALETTE[i].b);
+  }
+
+  // loop forever
+  put_bytes(b, "\x21\xff\x0bNETSCAPE2.0\x03\x01\0\0\0", 19);
+}
+
+static bool changed_rect(const slot_t *s, uint8_t *x0, uint8_t *y0,
+                         uint8_t *x1, uint8_t *y1) {
+  // bounding box of the pixels that differ from the previous frame
+  *x0 = SCREEN_WIDTH;
+  *y0 = SCREEN_HEIGHT;
+  *x1 = 0;
+  *y1 = 0;
+
+  for (uint8_t y = 0; y < SCREEN_HEIGHT; y++) {
+    if (memcmp(s->screen[y], s->prev[y], SCREEN_WIDTH) == 0) continue;
+    if (y < *y0) *y0 = y;
+    *y1 = y + 1;
+    for (uint8_t x = 0; x < SCREEN_WIDTH; x++) {
+      if (s->screen[y][x] == s->prev[y][x]) continue;
+      if (x < *x0) *x0 = x;
+      if (x >= *x1) *x1 = x + 1;
+    }
+  }
+  return *y1 > 0;
+}
+
+static void lzw(buf_t *b, const uint8_t *p, size_t n) {
+  // dict[code][pixel] is the code for code's string followed by pixel
+  uint16_t (*dict)[PALETTE_SIZE] = calloc(GIF_CODES, sizeof(*dict));
+  bits_t w = {b, 0, 0};
+  uint16_t next = GIF_END + 1;
+  uint8_t size = GIF_CODE_MIN + 1;
+  uint16_t cur = p[0];
+
+  put_bits(&w, GIF_CLEAR, size);
+
+  for (size_t i = 1; i < n; i++) {
+    if (dict[cur][p[i]]) {
+      cur = dict[cur][p[i]];
+      continue;
+    }
+    put_bits(&w, cur, size);
+
+    if (next < GIF_CODES) {
+      if (next == 1 << size) size++;
+      dict[cur][p[i]] = next++;
+    } else {
+      put_bits(&w, GIF_CLEAR, size);
+      memset(dict, 0, GIF_CODES * sizeof(*dict));
+      next = GIF_END + 1;
+      size = GIF_CODE_MIN + 1;
+    }
+    cur = p[i];
+  }
+  put_bits(&w, cur, size);
+  put_bits(&w, GIF_END, size);
+  if (w.n) put_bits(&w, 0, 8 - w.n);
+
+  free(dict);
+}
+
+static void encode_gif(const video_t *v, slot_t *s) {
+  uint8_t x0 = 0, y0 = 0, x1 = SCREEN_WIDTH, y1 = SCREEN_HEIGHT;
+  uint16_t delay = (s->frame + 1) * 100 / FPS - s->frame * 100 / FPS;
+  uint16_t width, height;
+  uint8_t *pixels;
+  buf_t codes = {0};
+
+  // the first frame is whole, later ones only cover what changed and an
+  // unchanged frame still needs one pixel to carry its delay
+  if (s->frame > 0 && !changed_rect(s, &x0, &y0, &x1, &y1)) {
+    x1 = 1;
+    y1 = 1;
+  }
+  width = (x1 - x0) * v->scale;
+  height = (y1 - y0) * v->scale;
+
+  pixels = malloc((size_t)width * height);
+  for (uint16_t y = 0; y < height; y++)
+    for (uint16_t x = 0; x < width; x++)
+      pixels[y * width + x] =
+          s->screen[y0 + y / v->scale][x0 + x / v->scale];
+
+  // graphic control: keep the previous frame under this one
+  put_bytes(&s->out, "\x21\xf9\x04\x04", 4);
+  put_u16_le(&s->out, delay);
+  put_byte(&s->out, 0);
+  put_byte(&s->out, 0);
+
+  put_byte(&s->out, 0x2c);
+  put_u16_le(&s->out, x0 * v->scale);
+  put_u16_le(&s->out, y0 * v->scale);
+  put_u16_le(&s->out, width);
+  put_u16_le(&s->out, height);
+  put_byte(&s->out, 0);
+
+  put_byte(&s->out, GIF_CODE_MIN);
+  lzw(&codes, pixels, (size_t)width * height);
+  for (size_t i = 0; i < codes.len; i += 255) {
+    put_byte(&s->out, codes.len - i < 255 ? codes.len - i : 255);
+    put_bytes(&s->out, codes.data + i,
+              codes.len - i < 255 ? codes.len - i : 255);
+  }
+  put_byte(&s->out, 0);
+
+  free(codes.data);
+  free(pixels);
+}
+
+/* THREADS */
+
+static void encode_slot(const video_t *v, slot_t *s) {
+  s->out.len = 0;
+
+  switch (v->format) {
+  case VIDEO_Y4M:
+    encode_y4m(v, s);
+    break;
+  case VIDEO_RGB:
+    encode_rgb(v, s);
+    break;
+  case VIDEO_PNG:
+    encode_png(v, s);
+    break;
+  case VIDEO_GIF:
+    encode_gif(v, s);
+    break;
+  }
+}
+
+static void write_slot(video_t *v, slot_t *s) {
+  char name[4096];
+  FILE *f;
+
+  if (v->format != VIDEO_PNG) {
+    fwrite(s->out.data, 1, s->out.len, v->file);
+    return;
+  }
+
+  snprintf(name, sizeof(name), "%s/%05u.png", v->path, s->frame);
+  if ((f = fopen(name, "wb")) == NULL) {
+    fprintf(stderr, "couldn't write %s\n", name);
+    return;
+  }
+  fwrite(s->out.data, 1, s->out.len, f);
+  fclose(f);
+}
+
+static void *video_worker(void *arg) {
+  video_t *v = arg;
+  slot_t *s;
+
+  pthread_mutex_lock(&v->lock);
+  for (;;) {
+    while (v->encoding == v->pushed && !v->closing)
+      pthread_cond_wait(&v->filled, &v->lock);
+    if (v->encoding == v->pushed) break;
+
+    s = &v->slots[v->encoding++ % VIDEO_SLOTS];
+    s->state = SLOT_ENCODING;
+    pthread_mutex_unlock(&v->lock);
+
+    encode_slot(v, s);
+
+    pthread_mutex_lock(&v->lock);
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast(&v->done);
+  }
+  pthread_mutex_unlock(&v->lock);
+  return NULL;
+}
+
+static void *video_writer(void *arg) {
+  video_t *v = arg;
+  slot_t *s;
+
+  pthread_mutex_lock(&v->lock);
+  for (;;) {
+    s = &v->slots[v->written % VIDEO_SLOTS];
+    while (s->state != SLOT_DONE && !(v->closing && v->written == v->pushed))
+      pthread_cond_wait(&v->done, &v->lock);
+    if (s->state != SLOT_DONE) break;
+    pthread_mutex_unlock(&v->lock);
+
+    write_slot(v, s);
+
+    pthread_mutex_lock(&v->lock);
+    s->state = SLOT_FREE;
+    v->written++;
+    pthread_cond_broadcast(&v->freed);
+  }
+  pthread_mutex_unlock(&v->lock);
+  return NULL;
+}
+
+/* VIDEO */
+
+video_t *open_video(video_format_t format, const char *path, uint8_t scale,
+                    uint8_t threads) {
+  video_t *v = calloc(1, sizeof(video_t));
+
+  v->format = format;
+  v->path = path;
+  v->scale = scale < 1 ? 1 : scale > VIDEO_SCALE_MAX ? VIDEO_SCALE_MAX : scale;
+  v->width = SCREEN_WIDTH * v->scale;
+  v->height = SCREEN_HEIGHT * v->scale;
+  v->threads = threads < 1                   ? 1
+               : threads > VIDEO_THREADS_MAX ? VIDEO_THREADS_MAX
+                                             : threads;
+
+  if (format == VIDEO_PNG) {
+    mkdir(path, 0755);
+  } else if (strcmp(path, "-") == 0) {
+    v->file = stdout;
+  } else if ((v->file = fopen(path, "wb")) == NULL) {
+    free(v);
+    return NULL;
+  }
+
+  if (format == VIDEO_Y4M)
+    fprintf(v->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", v->width,
+            v->height, FPS);
+
+  if (format == VIDEO_GIF) {
+    buf_t b = {0};
+    gif_header(&b, v->width, v->height);
+    fwrite(b.data, 1, b.len, v->file);
+    free(b.data);
+  }
+
+  init_crc_table();
+
+  pthread_mutex_init(&v->lock, NULL);
+  pthread_cond_init(&v->filled, NULL);
+  pthread_cond_init(&v->done, NULL);
+  pthread_cond_init(&v->freed, NULL);
+
+  for (uint8_t i = 0; i < v->threads; i++)
+    pthread_create(&v->workers[i], NULL, video_worker, v);
+  pthread_create(&v->writer, NULL, video_writer, v);
+
+  return v;
+}
+
+void push_video(video_t *v, const uint8_t *screen) {
+  slot_t *s;
+
+  pthread_mutex_lock(&v->lock);
+  s = &v->slots[v->pushed % VIDEO_SLOTS];
+  while (s->state != SLOT_FREE) pthread_cond_wait(&v->freed, &v->lock);
+  pthread_mutex_unlock(&v->lock);
+
+  memcpy(s->screen, screen, sizeof(s->screen));
+  memcpy(s->prev, v->last, sizeof(s->prev));
+  memcpy(v->last, screen, sizeof(v->last));
+  s->frame = v->pushed;
+
+  pthread_mutex_lock(&v->lock);
+  s->state = SLOT_FILLED;
+  v->pushed++;
+  pthread_cond_signal(&v->filled);
+  pthread_mutex_unlock(&v->lock);
+}
+
+void close_video(video_t *v) {
+  pthread_mutex_lock(&v->lock);
+  v->closing = true;
+  pthread_cond_broadcast(&v->filled);
+  pthread_cond_broadcast(&v->done);
+  pthread_mutex_unlock(&v->lock);
+
+  for (uint8_t i = 0; i < v->threads; i++) pthread_join(v->workers[i], NULL);
+  pthread_join(v->writer, NULL);
+
+  if (v->format == VIDEO_GIF) fputc(0x3b, v->file);
+  if (v->file && v->file != stdout) fclose(v->file);
+  if (v->file == stdout) fflush(stdout);
+
+  for (uint8_t i = 0; i < VIDEO_SLOTS; i++) free(v->slots[i].out.data);
+  pthread_mutex_destroy(&v->lock);
+  pthread_cond_destroy(&v->filled);
+  pthread_cond_destroy(&v->done);
+  pthread_cond_destroy(&v->freed);
+  free(v);
+}